@@ -0,0 +1,53 @@
+-- Reference config for macrodevice-bench, see "make bench"
+-- macrodevice-bench starts macrodevice-lua with this config and reads the output:
+-- macrodevice.arg[1] is the eventfile of the virtual device,
+-- macrodevice.arg[2] selects how the device is handled: "thread", "reactor", "queue", "isolated" or "frame".
+-- For every EV_MSC MSC_SCAN event the value (a sequence number) is written to stdout,
+-- the time it arrives is the input-to-callback latency.
+
+local eventfile = macrodevice.arg[1]
+local mode = macrodevice.arg[2] or "thread"
+
+-- every line has to reach macrodevice-bench immediately
+io.stdout:setvbuf( "line" )
+
+settings = {
+	backend = "libevdev",
+	eventfile = eventfile,
+	grab = true,
+	numbers = true,
+	reactor = ( mode == "reactor" ),
+	queue = ( mode == "queue" ),
+	isolated = ( mode == "isolated" ),
+}
+
+if mode == "frame" then
+	settings.batch = "frame"
+end
+
+-- EV_MSC = 4, MSC_SCAN = 4
+local function handle_event( event )
+	if event[1] == "4" and event[2] == "4" then
+		io.write( event[3], "\n" )
+	end
+end
+
+local function input_handler( event )
+	if mode == "frame" then
+		for i = 1, #event do
+			handle_event( event[i] )
+		end
+	else
+		handle_event( event )
+	end
+end
+
+if macrodevice.open( settings, input_handler ) == nil then
+	os.exit( 1 )
+end
+
+-- tells macrodevice-bench that the config has been loaded, it then sends probes (sequence number -1)
+-- until one arrives, as the device might not have been opened yet
+if macrodevice.main then
+	io.write( "ready\n" )
+end
@@ -37,7 +37,7 @@ function print_event( event )
 	end
 	
 	io.write( "then\n" )
-	io.write( "\tos.execute(\"place command here\")\n" )
+	io.write( "\tmacrodevice.spawn(\"place command here\")\n" )
 	io.write( "end\n" )
 	
 	io.flush()
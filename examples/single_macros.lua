@@ -11,8 +11,7 @@ settings = {
 }
 
 -- Edit this table to configure the macros.
--- Functions get called, strings passed to os.execute().
--- It is strongly recommended to add "&" to the end of commands to prevent blocking.
+-- Functions get called, strings passed to macrodevice.spawn(), which doesn't block.
 keymap = {
     ["down:KEY_ESC"] = macrodevice.close, -- request closing all opened devices
     ["down:KEY_A"] = "echo 'pressed a'",
@@ -41,7 +40,7 @@ function handle_input( event )
         if type(keymap[action_key]) == "function" then
             keymap[action_key]()
         elseif type(keymap[action_key]) == "string" then
-            os.execute(keymap[action_key])
+            macrodevice.spawn(keymap[action_key])
         end
     end
 	
@@ -0,0 +1,113 @@
+/*
+ * boot-report.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "boot-report.h"
+
+/**
+ * @copydoc macrodevice::boot_report::update
+ */
+void macrodevice::boot_report::update( const uint8_t *report, size_t size, uint64_t timestamp )
+{
+	m_count = m_position = 0;
+	
+	uint8_t modifiers = size > 0 ? report[0] : 0;
+	uint8_t keys[MACRODEVICE_BOOT_REPORT_KEYS] = {};
+	std::bitset< 256 > pressed;
+	
+	for( unsigned int i = 0, count = 0; i < MACRODEVICE_BOOT_REPORT_KEYS && i + 2 < size; i++ )
+	{
+		// phantom state, the keyboard can't tell which keys are pressed
+		if( report[i + 2] == 0x01 )
+			return;
+		
+		// a key in two slots is only kept once, so that it is neither pressed nor released twice
+		uint8_t key = report[i + 2];
+		if( key != 0 && !pressed.test( key ) )
+		{
+			keys[count++] = key;
+			pressed.set( key );
+		}
+	}
+	
+	// released keys, then released modifiers, pressed modifiers and pressed keys, so that a chord is complete at its last press
+	for( unsigned int i = 0; i < MACRODEVICE_BOOT_REPORT_KEYS; i++ )
+	{
+		if( m_keys[i] != 0 && !pressed.test( m_keys[i] ) )
+			add_change( modifiers, m_keys[i], 0, timestamp );
+	}
+	
+	uint8_t changed = modifiers ^ m_modifiers;
+	for( unsigned int bit = 0; bit < 8; bit++ )
+	{
+		if( ( changed & ( 1 << bit ) ) && !( modifiers & ( 1 << bit ) ) )
+			add_change( modifiers, MACRODEVICE_BOOT_REPORT_MODIFIER_USAGE + bit, 0, timestamp );
+	}
+	for( unsigned int bit = 0; bit < 8; bit++ )
+	{
+		if( ( changed & ( 1 << bit ) ) && ( modifiers & ( 1 << bit ) ) )
+			add_change( modifiers, MACRODEVICE_BOOT_REPORT_MODIFIER_USAGE + bit, 1, timestamp );
+	}
+	
+	for( unsigned int i = 0; i < MACRODEVICE_BOOT_REPORT_KEYS; i++ )
+	{
+		if( keys[i] != 0 && !m_pressed.test( keys[i] ) )
+			add_change( modifiers, keys[i], 1, timestamp );
+	}
+	
+	m_modifiers = modifiers;
+	std::copy( keys, keys + MACRODEVICE_BOOT_REPORT_KEYS, m_keys );
+	m_pressed = pressed;
+}
+
+/**
+ * @copydoc macrodevice::boot_report::next_change
+ */
+bool macrodevice::boot_report::next_change( macrodevice::event &event )
+{
+	if( m_position >= m_count )
+		return false;
+	
+	event = m_changes[m_position++];
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::boot_report::reset
+ */
+void macrodevice::boot_report::reset()
+{
+	m_modifiers = 0;
+	std::fill( m_keys, m_keys + MACRODEVICE_BOOT_REPORT_KEYS, 0 );
+	m_pressed.reset();
+	m_count = m_position = 0;
+}
+
+/**
+ * @copydoc macrodevice::boot_report::add_change
+ */
+void macrodevice::boot_report::add_change( uint8_t modifiers, uint8_t key, int value, uint64_t timestamp )
+{
+	macrodevice::event &change = m_changes[m_count++];
+	change.clear();
+	change.timestamp = timestamp;
+	change.push( modifiers );
+	change.push( key );
+	change.push( value );
+}
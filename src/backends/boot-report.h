@@ -0,0 +1,95 @@
+/*
+ * boot-report.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_BOOT_REPORT
+#define MACRODEVICE_BOOT_REPORT
+
+#include <bitset>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "helpers.h"
+
+/// Number of key slots in a boot protocol keyboard report
+#define MACRODEVICE_BOOT_REPORT_KEYS 6
+
+/// Maximum number of changes between two reports: all keys released, all modifiers changed, all keys pressed
+#define MACRODEVICE_BOOT_REPORT_CHANGES ( 2 * MACRODEVICE_BOOT_REPORT_KEYS + 8 )
+
+/// HID usage of the first modifier key (left control), bit n of the modifier byte is usage 0xe0 + n
+#define MACRODEVICE_BOOT_REPORT_MODIFIER_USAGE 0xe0
+
+namespace macrodevice
+{
+	class boot_report;
+}
+
+/**
+ * Compares each boot protocol keyboard report (modifiers, reserved, 6 keys) with the previous one
+ * and turns the differences into press and release events: { modifiers, key, 1 or 0 }.
+ * Modifiers are passed as keys with their HID usage (0xe0 to 0xe7).
+ */
+class macrodevice::boot_report
+{
+	
+	private:
+		
+		/// the previous report, each key only once
+		uint8_t m_modifiers = 0;
+		uint8_t m_keys[MACRODEVICE_BOOT_REPORT_KEYS] = {};
+		
+		/// the keys of the previous report, indexed by usage
+		std::bitset< 256 > m_pressed;
+		
+		/// the changes of the last report, m_changes[m_position] is the next one
+		macrodevice::event m_changes[MACRODEVICE_BOOT_REPORT_CHANGES];
+		unsigned int m_count = 0, m_position = 0;
+		
+		/// Appends a change to m_changes
+		void add_change( uint8_t modifiers, uint8_t key, int value, uint64_t timestamp );
+		
+	public:
+		
+		/**
+		 * Compares a report with the previous one, the changes replace those of the previous report
+		 * Reports with the ErrorRollOver code (too many keys pressed) are ignored
+		 * @param report The report, starting with the modifier byte
+		 * @param size The size of the report, missing key slots count as empty
+		 * @param timestamp The timestamp of the events
+		 */
+		void update( const uint8_t *report, size_t size, uint64_t timestamp );
+		
+		/**
+		 * Takes the next change of the last report
+		 * @param event The change
+		 * @return false if all changes have been taken
+		 */
+		bool next_change( macrodevice::event &event );
+		
+		/**
+		 * Forgets the previous report, e.g. after opening the device
+		 */
+		void reset();
+		
+};
+
+#endif
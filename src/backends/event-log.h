@@ -0,0 +1,75 @@
+/*
+ * event-log.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_EVENT_LOG
+#define MACRODEVICE_EVENT_LOG
+
+#include <cstdint>
+
+/*
+ * An event log is a sequence of records in native byte order, written by the record setting and read by the replay backend.
+ * Each recording session starts with the magic bytes, followed by name and event records.
+ * A name record assigns an index to the name of a field, event records refer to names by their index.
+ * The indices are only valid until the next magic bytes.
+ */
+
+/// Magic bytes at the start of every recording session
+#define MACRODEVICE_LOG_MAGIC "MDEVLOG1"
+#define MACRODEVICE_LOG_MAGIC_SIZE 8
+
+/// Kinds of records
+#define MACRODEVICE_LOG_EVENT 0
+#define MACRODEVICE_LOG_NAME 1
+
+/// Name index of fields without a name
+#define MACRODEVICE_LOG_NO_NAME 0xffff
+
+namespace macrodevice
+{
+	/// Header of an event record, followed by size fields and payload_size bytes of payload
+	struct __attribute__(( packed )) log_event
+	{
+		uint8_t kind;
+		uint8_t size;
+		uint8_t has_payload;
+		uint8_t reserved;
+		uint32_t payload_size;
+		uint64_t timestamp;
+	};
+	
+	/// A field of an event record
+	struct __attribute__(( packed )) log_field
+	{
+		int64_t value;
+		uint16_t name;
+	};
+	
+	/// Header of a name record, followed by length bytes of the name, including the terminating '\0'
+	struct __attribute__(( packed )) log_name
+	{
+		uint8_t kind;
+		uint8_t reserved;
+		uint16_t index;
+		uint16_t length;
+	};
+}
+
+#endif
@@ -41,3 +41,29 @@ bool macrodevice::string_to_bool( std::string value, bool fallback )
 	
 	return fallback;
 }
+
+/**
+ * @copydoc macrodevice::split_list
+ */
+std::vector< std::string > macrodevice::split_list( const std::string &value )
+{
+	std::vector< std::string > items;
+	
+	size_t start = 0;
+	while( start <= value.size() )
+	{
+		size_t end = value.find( ',', start );
+		if( end == std::string::npos )
+			end = value.size();
+		
+		// remove whitespace
+		size_t first = value.find_first_not_of( " \t", start );
+		size_t last = value.find_last_not_of( " \t", end-1 );
+		if( first != std::string::npos && first < end && last != std::string::npos && last >= first )
+			items.push_back( value.substr( first, last-first+1 ) );
+		
+		start = end+1;
+	}
+	
+	return items;
+}
@@ -23,15 +23,75 @@
 #define MACRODEVICE_HELPERS
 
 #include <string>
+#include <vector>
 #include <locale>
+#include <cstddef>
+#include <cstdint>
+#include <time.h>
 
 #define MACRODEVICE_SUCCESS 0
 #define MACRODEVICE_TIMEOUT -1
 #define MACRODEVICE_FAILURE 1
 
+/// Maximum number of fields in an event
+#define MACRODEVICE_EVENT_SIZE 4
+
 namespace macrodevice
 {
 	
+	/**
+	 * An event as received by a backend, this is a fixed size struct without heap allocations.
+	 * An event consists of up to MACRODEVICE_EVENT_SIZE numeric fields, each with an optional name,
+	 * or of a single string field (payload), e.g. a serial message.
+	 */
+	struct event
+	{
+		/// number of numeric fields
+		unsigned int size = 0;
+		
+		/// the value of each field
+		long long value[MACRODEVICE_EVENT_SIZE];
+		
+		/// the name of each field or NULL, points to static storage
+		const char *name[MACRODEVICE_EVENT_SIZE];
+		
+		/// the string field or NULL, points into a buffer of the backend and is valid until the next call of wait_for_event
+		const char *payload = NULL;
+		size_t payload_size = 0;
+		
+		/// the time the event has been received, in ns of CLOCK_MONOTONIC
+		uint64_t timestamp = 0;
+		
+		/// Removes all fields
+		void clear()
+		{
+			size = 0;
+			payload = NULL;
+			payload_size = 0;
+		}
+		
+		/// Appends a numeric field with an optional name
+		void push( long long field_value, const char *field_name = NULL )
+		{
+			if( size < MACRODEVICE_EVENT_SIZE )
+			{
+				value[size] = field_value;
+				name[size] = field_name;
+				size++;
+			}
+		}
+	};
+	
+	/**
+	 * \brief Returns the current time of CLOCK_MONOTONIC in ns, used for the timestamps of events
+	 */
+	inline uint64_t monotonic_ns()
+	{
+		struct timespec now;
+		clock_gettime( CLOCK_MONOTONIC, &now );
+		return now.tv_sec * 1000000000ull + now.tv_nsec;
+	}
+	
 	/**
 	 * \brief Converts a string to a bool
 	 * true: "true" "yes" "1"
@@ -39,5 +99,11 @@ namespace macrodevice
 	 */
 	bool string_to_bool( std::string value, bool fallback );
 	
+	/**
+	 * \brief Splits a comma separated list, e.g. "EV_KEY, EV_REL"
+	 * Whitespace around the items and empty items are removed
+	 */
+	std::vector< std::string > split_list( const std::string &value );
+	
 }
 #endif
@@ -0,0 +1,322 @@
+/*
+ * hid-report.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "hid-report.h"
+
+/// Maximum number of usages of an item, larger usage ranges get truncated
+#define MACRODEVICE_HID_REPORT_USAGES 65536
+
+/**
+ * @copydoc macrodevice::hid_report::parse
+ */
+bool macrodevice::hid_report::parse( const uint8_t *descriptor, size_t size )
+{
+	m_fields.clear();
+	m_report_ids = false;
+	m_changes.clear();
+	m_position = 0;
+	
+	// the global items, saved and restored by push and pop
+	struct global_items
+	{
+		uint32_t usage_page = 0;
+		int64_t logical_minimum = 0;
+		int64_t logical_maximum = 0;
+		uint32_t logical_maximum_unsigned = 0;
+		uint32_t report_size = 0, report_count = 0;
+		uint8_t report_id = 0;
+	};
+	global_items global;
+	std::vector< global_items > stack;
+	
+	// the local items, cleared by each main item
+	std::vector< uint32_t > usages;
+	uint32_t usage_minimum = 0;
+	bool has_usage_minimum = false;
+	
+	// the size of the input items of each report so far, in bits
+	size_t offsets[256] = {};
+	
+	size_t i = 0;
+	while( i < size )
+	{
+		uint8_t prefix = descriptor[i++];
+		
+		// long items are reserved, skip them
+		if( prefix == 0xfe )
+		{
+			if( i >= size )
+				return false;
+			
+			i += 2 + descriptor[i];
+			continue;
+		}
+		
+		unsigned int data_size = ( prefix & 0x03 ) == 3 ? 4 : prefix & 0x03;
+		unsigned int type = ( prefix >> 2 ) & 0x03;
+		unsigned int tag = prefix >> 4;
+		
+		if( i + data_size > size )
+			return false;
+		
+		uint32_t data = 0;
+		for( unsigned int k = 0; k < data_size; k++ )
+			data |= (uint32_t)descriptor[i + k] << ( 8 * k );
+		i += data_size;
+		
+		int64_t signed_data = data_size == 1 ? (int8_t)data : data_size == 2 ? (int16_t)data : (int32_t)data;
+		
+		// usages with 4 bytes contain the usage page
+		uint32_t extended_usage = data_size == 4 ? data : global.usage_page << 16 | ( data & 0xffff );
+		
+		if( type == 0 ) // main items
+		{
+			// input items, constant items are padding
+			if( tag == 0x8 && !( data & 0x01 ) && global.report_size > 0 && global.report_size <= 32 && global.report_count > 0 )
+			{
+				field item;
+				item.report_id = global.report_id;
+				item.offset = offsets[global.report_id];
+				item.size = global.report_size;
+				item.count = global.report_count;
+				item.logical_minimum = global.logical_minimum;
+				item.logical_maximum = global.logical_maximum;
+				item.array = !( data & 0x02 );
+				item.relative = data & 0x04;
+				item.usages = usages;
+				
+				// many descriptors use a logical maximum of e.g. 0xff with a single byte, meaning 255 instead of -1
+				if( item.logical_minimum >= 0 && item.logical_maximum < 0 )
+					item.logical_maximum = global.logical_maximum_unsigned;
+				
+				// items without usages pass the value as usage (arrays) or usage 0 of the usage page (variables)
+				if( item.usages.empty() && item.array )
+				{
+					for( int64_t v = std::max< int64_t >( item.logical_minimum, 0 );
+						v <= item.logical_maximum && item.usages.size() < MACRODEVICE_HID_REPORT_USAGES; v++ )
+						item.usages.push_back( global.usage_page << 16 | ( v & 0xffff ) );
+				}
+				else if( item.usages.empty() )
+				{
+					item.usages.push_back( global.usage_page << 16 );
+				}
+				
+				item.state.assign( item.count, 0 );
+				m_fields.push_back( std::move( item ) );
+			}
+			
+			if( tag == 0x8 )
+				offsets[global.report_id] += (size_t)global.report_size * global.report_count;
+			
+			usages.clear();
+			has_usage_minimum = false;
+		}
+		else if( type == 1 ) // global items
+		{
+			switch( tag )
+			{
+				case 0x0: global.usage_page = data & 0xffff; break;
+				case 0x1: global.logical_minimum = signed_data; break;
+				case 0x2: global.logical_maximum = signed_data; global.logical_maximum_unsigned = data; break;
+				case 0x7: global.report_size = data; break;
+				case 0x8: global.report_id = data; m_report_ids = true; break;
+				case 0x9: global.report_count = data; break;
+				case 0xa: stack.push_back( global ); break;
+				case 0xb:
+					if( stack.empty() )
+						return false;
+					global = stack.back();
+					stack.pop_back();
+					break;
+			}
+		}
+		else if( type == 2 ) // local items
+		{
+			switch( tag )
+			{
+				case 0x0:
+					if( usages.size() < MACRODEVICE_HID_REPORT_USAGES )
+						usages.push_back( extended_usage );
+					break;
+				case 0x1:
+					usage_minimum = extended_usage;
+					has_usage_minimum = true;
+					break;
+				case 0x2:
+					if( has_usage_minimum )
+					{
+						for( uint64_t u = usage_minimum; u <= extended_usage && usages.size() < MACRODEVICE_HID_REPORT_USAGES; u++ )
+							usages.push_back( u );
+					}
+					has_usage_minimum = false;
+					break;
+			}
+		}
+	}
+	
+	return !m_fields.empty();
+}
+
+/**
+ * @copydoc macrodevice::hid_report::update
+ */
+void macrodevice::hid_report::update( const uint8_t *report, size_t size, uint64_t timestamp )
+{
+	m_changes.clear();
+	m_position = 0;
+	
+	uint8_t report_id = 0;
+	if( m_report_ids )
+	{
+		if( size == 0 )
+			return;
+		
+		report_id = report[0];
+		report++;
+		size--;
+	}
+	
+	for( field &item : m_fields )
+	{
+		if( item.report_id != report_id )
+			continue;
+		
+		bool is_signed = item.logical_minimum < 0;
+		
+		if( !item.array )
+		{
+			for( unsigned int i = 0; i < item.count; i++ )
+			{
+				int32_t value = extract( report, size, item.offset + (size_t)i * item.size, item.size, is_signed );
+				uint32_t usage = item.usages[std::min< size_t >( i, item.usages.size() - 1 )];
+				
+				if( item.relative )
+				{
+					if( value != 0 )
+						add_change( usage, value, timestamp );
+				}
+				else if( (uint32_t)value != item.state[i] )
+				{
+					item.state[i] = value;
+					add_change( usage, value, timestamp );
+				}
+			}
+			
+			continue;
+		}
+		
+		// the usages of the array
+		m_array.clear();
+		bool rollover = false;
+		for( unsigned int i = 0; i < item.count; i++ )
+		{
+			int64_t value = extract( report, size, item.offset + (size_t)i * item.size, item.size, is_signed );
+			if( value < item.logical_minimum || value > item.logical_maximum || value - item.logical_minimum >= (int64_t)item.usages.size() )
+				continue;
+			
+			uint32_t usage = item.usages[value - item.logical_minimum];
+			
+			// phantom state of keyboards (ErrorRollOver, POSTFail, ErrorUndefined), the pressed keys are unknown
+			if( usage >= 0x00070001 && usage <= 0x00070003 )
+				rollover = true;
+			
+			// usage 0 means no key
+			if( ( usage & 0xffff ) != 0 && std::find( m_array.begin(), m_array.end(), usage ) == m_array.end() )
+				m_array.push_back( usage );
+		}
+		
+		if( rollover )
+			continue;
+		
+		// releases first, then presses
+		for( uint32_t usage : item.state )
+		{
+			if( usage != 0 && std::find( m_array.begin(), m_array.end(), usage ) == m_array.end() )
+				add_change( usage, 0, timestamp );
+		}
+		for( uint32_t usage : m_array )
+		{
+			if( std::find( item.state.begin(), item.state.end(), usage ) == item.state.end() )
+				add_change( usage, 1, timestamp );
+		}
+		
+		std::fill( item.state.begin(), item.state.end(), 0 );
+		std::copy( m_array.begin(), m_array.end(), item.state.begin() );
+	}
+}
+
+/**
+ * @copydoc macrodevice::hid_report::next_change
+ */
+bool macrodevice::hid_report::next_change( macrodevice::event &event )
+{
+	if( m_position >= m_changes.size() )
+		return false;
+	
+	event = m_changes[m_position++];
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::hid_report::reset
+ */
+void macrodevice::hid_report::reset()
+{
+	for( field &item : m_fields )
+		std::fill( item.state.begin(), item.state.end(), 0 );
+	
+	m_changes.clear();
+	m_position = 0;
+}
+
+/**
+ * @copydoc macrodevice::hid_report::add_change
+ */
+void macrodevice::hid_report::add_change( uint32_t usage, long long value, uint64_t timestamp )
+{
+	macrodevice::event &change = m_changes.emplace_back();
+	change.timestamp = timestamp;
+	change.push( usage >> 16 );
+	change.push( usage & 0xffff );
+	change.push( value );
+}
+
+/**
+ * @copydoc macrodevice::hid_report::extract
+ */
+int32_t macrodevice::hid_report::extract( const uint8_t *data, size_t size, size_t offset, unsigned int bits, bool is_signed )
+{
+	// a value of up to 32 bits spans at most 5 bytes
+	uint64_t value = 0;
+	size_t first = offset / 8;
+	unsigned int shift = offset % 8;
+	for( unsigned int k = 0; k * 8 < shift + bits; k++ )
+	{
+		if( first + k < size )
+			value |= (uint64_t)data[first + k] << ( 8 * k );
+	}
+	
+	value = ( value >> shift ) & ( ( 1ull << bits ) - 1 );
+	
+	if( is_signed && ( value >> ( bits - 1 ) ) & 1 )
+		value |= ~0ull << bits;
+	
+	return (int32_t)value;
+}
@@ -0,0 +1,130 @@
+/*
+ * hid-report.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_HID_REPORT
+#define MACRODEVICE_HID_REPORT
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "helpers.h"
+
+namespace macrodevice
+{
+	class hid_report;
+}
+
+/**
+ * Parses the input items of a HID report descriptor, then compares each input report with the previous one
+ * and turns the differences into events: { usage page, usage, value }.
+ * Variable items pass their new value when it changes (relative items whenever it isn't 0),
+ * array items (e.g. the keys of a keyboard) pass value 1 for each added usage and 0 for each removed usage.
+ */
+class macrodevice::hid_report
+{
+	
+	private:
+		
+		/// an input item of the report descriptor
+		struct field
+		{
+			uint8_t report_id = 0;
+			
+			/// position of the first value in bits, after the report id
+			size_t offset = 0;
+			
+			/// size of each value in bits, and number of values
+			unsigned int size = 0, count = 0;
+			
+			int64_t logical_minimum = 0, logical_maximum = 0;
+			
+			bool array = false, relative = false;
+			
+			/// extended usages (usage page << 16 | usage): of each value for variable items, the last one is repeated,
+			/// of each possible value starting at logical_minimum for array items
+			std::vector< uint32_t > usages;
+			
+			/// the values of the previous report, the extended usages for array items
+			std::vector< uint32_t > state;
+		};
+		
+		/// all input items
+		std::vector< field > m_fields;
+		
+		/// do reports start with a report id?
+		bool m_report_ids = false;
+		
+		/// the changes of the last report, m_changes[m_position] is the next one
+		std::vector< macrodevice::event > m_changes;
+		size_t m_position = 0;
+		
+		/// the values of the current array item, reused for every report
+		std::vector< uint32_t > m_array;
+		
+		/// Appends a change to m_changes
+		void add_change( uint32_t usage, long long value, uint64_t timestamp );
+		
+		/**
+		 * Reads a value from a report
+		 * @param data The report, after the report id
+		 * @param size The size of the report in bytes, missing bits are 0
+		 * @param offset The position of the value in bits
+		 * @param bits The size of the value in bits, at most 32
+		 * @param is_signed Sign extend the value?
+		 */
+		static int32_t extract( const uint8_t *data, size_t size, size_t offset, unsigned int bits, bool is_signed );
+		
+	public:
+		
+		/**
+		 * Parses a report descriptor, replaces the previous one
+		 * @param descriptor The report descriptor, e.g. from HIDIOCGRDESC
+		 * @param size The size of the descriptor
+		 * @return false if the descriptor is invalid or doesn't contain any input items
+		 */
+		bool parse( const uint8_t *descriptor, size_t size );
+		
+		/**
+		 * Compares a report with the previous report with the same id, the changes replace those of the previous report
+		 * Array items containing ErrorRollOver (too many keys pressed) are ignored
+		 * @param report The report, starting with the report id if the descriptor uses report ids
+		 * @param size The size of the report
+		 * @param timestamp The timestamp of the events
+		 */
+		void update( const uint8_t *report, size_t size, uint64_t timestamp );
+		
+		/**
+		 * Takes the next change of the last report
+		 * @param event The change
+		 * @return false if all changes have been taken
+		 */
+		bool next_change( macrodevice::event &event );
+		
+		/**
+		 * Forgets the previous reports, e.g. after opening the device
+		 */
+		void reset();
+		
+};
+
+#endif
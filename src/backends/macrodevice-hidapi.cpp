@@ -31,6 +31,24 @@ int macrodevice::device_hidapi::load_settings( const std::map< std::string, std:
 	{
 		m_vid = std::stoi( settings.at("vid"), 0, 16);
 		m_pid = std::stoi( settings.at("pid"), 0, 16);
+		
+		if( settings.find( "diff" ) != settings.end() )
+		{
+			m_diff = macrodevice::string_to_bool( settings.at( "diff" ), false );
+		}
+		if( settings.find( "mode" ) != settings.end() )
+		{
+			if( settings.at( "mode" ) == "input" )
+				m_input_reports = true;
+			else if( settings.at( "mode" ) == "request" )
+				m_input_reports = false;
+			else
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.find( "timeout" ) != settings.end() )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
 	}
 	catch( std::exception &e )
 	{
@@ -60,6 +78,8 @@ int macrodevice::device_hidapi::open_device()
 		return MACRODEVICE_FAILURE;
 	}
 	
+	m_report.reset();
+	m_last_key = 0;
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -82,52 +102,90 @@ int macrodevice::device_hidapi::close_device()
 /**
  * @copydoc macrodevice::device_hidapi::wait_for_event
  */
-int macrodevice::device_hidapi::wait_for_event( std::vector< std::string > &event )
+int macrodevice::device_hidapi::wait_for_event( macrodevice::event &event )
 {
 	
 	unsigned char buffer[65]; // for reading and writing to the device
-	unsigned char key_old = 0, key_new = 0;
-	int res = MACRODEVICE_SUCCESS; // return value of this function
+	
+	// the remaining changes of the last report
+	if( m_diff && m_report.next_change( event ) )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	// in request mode the device answers every request at once, even if no key has changed,
+	// so the timeout applies to the whole wait, not to each read
+	uint64_t deadline = macrodevice::monotonic_ns() + (uint64_t)std::max( m_timeout, 0 ) * 1000000;
 	
 	// run until a keypress occurs
 	while( 1 )
 	{
-		
-		
-		// request device state
-		buffer[1] = 0x81;
-		if( hid_write( m_device, buffer, 65 ) < 0 )
+		// the remaining time until the deadline
+		int timeout = m_timeout;
+		if( m_timeout > 0 )
 		{
-			res = MACRODEVICE_FAILURE;
-			break;
+			uint64_t now = macrodevice::monotonic_ns();
+			timeout = now < deadline ? ( deadline - now + 999999 ) / 1000000 : 0;
 		}
 		
+		// request device state, the first byte is the report id
+		if( !m_input_reports )
+		{
+			std::fill( buffer, buffer + sizeof( buffer ), 0 );
+			buffer[1] = 0x81;
+			if( hid_write( m_device, buffer, 65 ) < 0 )
+			{
+				return MACRODEVICE_FAILURE;
+			}
+		}
 		
-		// read requested state
-		if( hid_read( m_device, buffer, 65 ) < 0 )
+		// read the next report, unused bytes stay zero
+		std::fill( buffer, buffer + sizeof( buffer ), 0 );
+		int size = hid_read_timeout( m_device, buffer, 65, timeout );
+		if( size < 0 )
 		{
-			res = MACRODEVICE_FAILURE;
-			break;
+			return MACRODEVICE_FAILURE;
+		}
+		else if( size == 0 )
+		{
+			return MACRODEVICE_TIMEOUT;
 		}
 		
-		key_old = key_new;
-		key_new = buffer[2];
+		uint64_t timestamp = macrodevice::monotonic_ns();
 		
-		// if key is pressed
-		if( key_old == 0 && key_new != 0 )
+		if( m_diff )
 		{
-			// clear event vector
-			event.clear();
+			m_report.update( buffer, size, timestamp );
 			
-			// add modifier value to event
-			event.push_back( std::to_string(buffer[0]) );
-			// add key value to event
-			event.push_back( std::to_string(key_new) );
+			if( m_report.next_change( event ) )
+				return MACRODEVICE_SUCCESS;
+		}
+		else
+		{
+			unsigned char key_old = m_last_key;
+			m_last_key = buffer[2];
 			
-			break;
+			// if key is pressed
+			if( key_old == 0 && m_last_key != 0 )
+			{
+				// clear event
+				event.clear();
+				event.timestamp = timestamp;
+				
+				// add modifier value to event
+				event.push( buffer[0] );
+				// add key value to event
+				event.push( m_last_key );
+				
+				return MACRODEVICE_SUCCESS;
+			}
+		}
+		
+		// no key has changed, so that the device can be closed the wait ends at the deadline
+		if( m_timeout >= 0 && macrodevice::monotonic_ns() >= deadline )
+		{
+			return MACRODEVICE_TIMEOUT;
 		}
 		
 	}
-	
-	return res;
 }
@@ -26,10 +26,12 @@
 #include <map>
 #include <string>
 #include <exception>
+#include <algorithm>
 
 #include </usr/include/hidapi/hidapi.h>
 
 #include "helpers.h"
+#include "boot-report.h"
 
 namespace macrodevice
 {
@@ -48,11 +50,28 @@ class macrodevice::device_hidapi
 		
 		int m_vid = 0, m_pid = 0;
 		
+		/// only read the input reports of the device, instead of requesting each report with an output report?
+		bool m_input_reports = false;
+		
+		/// timeout of each read in ms, -1 for no timeout
+		/// hidapi can't interrupt a waiting read (hid_close must not be called while another thread reads), so without a
+		/// timeout closing the device waits for the next report, the default wakes up once per second to check for it
+		int m_timeout = 1000;
+		
+		/// the key of the last report, to detect key presses
+		unsigned char m_last_key = 0;
+		
+		/// pass press and release events for all keys and modifiers?
+		bool m_diff = false;
+		
+		/// compares the reports with diff = true
+		macrodevice::boot_report m_report;
+		
 	public:
 		
 		/**
 		 * Loads the device settings, e.g. USB VID, USB PID
-		 * Valid settings keys are: vid, pid
+		 * Valid settings keys are: vid, pid, diff, mode, timeout
 		 * @param settings A map of settings keys to their values
 		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if required settings are missing or invalid
 		 */
@@ -74,10 +93,10 @@ class macrodevice::device_hidapi
 		
 		/**
 		 * Waits for an event, i.e. keypress to occur
-		 * @param event The received event, typically of size == 2
-		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * @param event The received event, of size 2, or 3 with diff = true
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
 		 */
-		int wait_for_event( std::vector< std::string > &event );
+		int wait_for_event( macrodevice::event &event );
 		
 };
 
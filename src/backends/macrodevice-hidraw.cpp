@@ -0,0 +1,283 @@
+/*
+ * macrodevice-hidraw.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "macrodevice-hidraw.h"
+
+/**
+ * @copydoc macrodevice::device_hidraw::load_settings
+ */
+int macrodevice::device_hidraw::load_settings( const std::map< std::string, std::string > &settings )
+{
+	try
+	{
+		
+		// the path of the device, or vid and pid to find it
+		if( settings.contains( "path" ) )
+		{
+			m_path = settings.at( "path" );
+		}
+		else
+		{
+			m_vid = std::stoi( settings.at( "vid" ), 0, 16 );
+			m_pid = std::stoi( settings.at( "pid" ), 0, 16 );
+		}
+		
+		if( settings.contains( "raw" ) )
+		{
+			m_raw = macrodevice::string_to_bool( settings.at( "raw" ), false );
+		}
+		if( settings.contains( "timeout" ) )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
+		
+	}
+	catch( std::exception &e )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::open_device
+ */
+int macrodevice::device_hidraw::open_device()
+{
+	std::string path = m_path.empty() ? find_device() : m_path;
+	if( path.empty() )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// reads never block, waiting happens with poll()
+	m_filedesc = open( path.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC );
+	if( m_filedesc < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	if( !m_raw && read_descriptor() != MACRODEVICE_SUCCESS )
+	{
+		close( m_filedesc );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_wake = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+	if( m_wake < 0 )
+	{
+		close( m_filedesc );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_buffer.resize( MACRODEVICE_HIDRAW_BUFFER_SIZE );
+	
+	// set up polling
+	m_pollfd[0].fd = m_filedesc;
+	m_pollfd[0].events = POLLIN;
+	m_pollfd[1].fd = m_wake;
+	m_pollfd[1].events = POLLIN;
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::close_device
+ */
+int macrodevice::device_hidraw::close_device()
+{
+	close( m_wake );
+	close( m_filedesc );
+	m_wake = m_filedesc = -1;
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::find_device
+ */
+std::string macrodevice::device_hidraw::find_device()
+{
+	// the first matching device in the order of the device numbers
+	std::vector< std::pair< int, std::string > > candidates;
+	try
+	{
+		for( auto &entry : std::filesystem::directory_iterator( "/dev" ) )
+		{
+			std::string name = entry.path().filename().string();
+			if( name.starts_with( "hidraw" ) && name.size() > 6 )
+				candidates.push_back( { std::stoi( name.substr( 6 ) ), entry.path().string() } );
+		}
+	}
+	catch( std::exception &e )
+	{
+		return "";
+	}
+	std::sort( candidates.begin(), candidates.end() );
+	
+	for( auto &candidate : candidates )
+	{
+		int fd = open( candidate.second.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC );
+		if( fd < 0 )
+			continue;
+		
+		struct hidraw_devinfo info;
+		bool found = ioctl( fd, HIDIOCGRAWINFO, &info ) == 0 &&
+			(uint16_t)info.vendor == m_vid && (uint16_t)info.product == m_pid;
+		close( fd );
+		
+		if( found )
+			return candidate.second;
+	}
+	
+	return "";
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::read_descriptor
+ */
+int macrodevice::device_hidraw::read_descriptor()
+{
+	struct hidraw_report_descriptor descriptor;
+	int size = 0;
+	
+	if( ioctl( m_filedesc, HIDIOCGRDESCSIZE, &size ) < 0 || size <= 0 || size > HID_MAX_DESCRIPTOR_SIZE )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	descriptor.size = size;
+	if( ioctl( m_filedesc, HIDIOCGRDESC, &descriptor ) < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// the device has to send input reports
+	if( !m_report.parse( descriptor.value, descriptor.size ) )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::wait_for_event
+ */
+int macrodevice::device_hidraw::wait_for_event( macrodevice::event &event )
+{
+	// the remaining changes of the last report
+	if( !m_raw && m_report.next_change( event ) )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	uint64_t deadline = m_timeout > 0 ? macrodevice::monotonic_ns() + m_timeout * 1000000ull : 0;
+	
+	while( true )
+	{
+		// each read returns a single report
+		ssize_t size = read( m_filedesc, m_buffer.data(), m_buffer.size() );
+		if( size > 0 )
+		{
+			uint64_t timestamp = macrodevice::monotonic_ns();
+			
+			if( m_raw )
+			{
+				event.clear();
+				event.timestamp = timestamp;
+				event.payload = m_buffer.data();
+				event.payload_size = size;
+				
+				return MACRODEVICE_SUCCESS;
+			}
+			
+			m_report.update( (const uint8_t*)m_buffer.data(), size, timestamp );
+			if( m_report.next_change( event ) )
+			{
+				return MACRODEVICE_SUCCESS;
+			}
+			
+			continue;
+		}
+		else if( size == 0 || ( errno != EAGAIN && errno != EINTR ) )
+		{
+			// e.g. the device has been disconnected
+			return MACRODEVICE_FAILURE;
+		}
+		
+		// wait for the next report
+		int timeout = m_timeout;
+		if( m_timeout > 0 )
+		{
+			uint64_t now = macrodevice::monotonic_ns();
+			timeout = now < deadline ? ( deadline - now + 999999 ) / 1000000 : 0;
+		}
+		
+		int p = poll( m_pollfd, 2, timeout );
+		if( p < 0 && errno != EINTR )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		else if( p == 0 )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+		else if( p > 0 && ( m_pollfd[1].revents & POLLIN ) )
+		{
+			uint64_t value;
+			if( read( m_wake, &value, sizeof( value ) ) < 0 )
+			{
+				// already reset
+			}
+			return MACRODEVICE_TIMEOUT;
+		}
+		else if( p > 0 && ( m_pollfd[0].revents & ( POLLERR|POLLHUP ) ) )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::get_pollfds
+ */
+int macrodevice::device_hidraw::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	fds.push_back( { m_filedesc, POLLIN, 0 } );
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_hidraw::interrupt
+ */
+void macrodevice::device_hidraw::interrupt()
+{
+	if( m_wake >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wake, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, wait_for_event gets woken up anyway
+		}
+	}
+}
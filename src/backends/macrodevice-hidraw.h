@@ -0,0 +1,147 @@
+/*
+ * macrodevice-hidraw.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_HIDRAW
+#define MACRODEVICE_HIDRAW
+
+#include <vector>
+#include <map>
+#include <string>
+#include <exception>
+#include <filesystem>
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/types.h> // for open()
+#include <sys/stat.h> // for open()
+#include <fcntl.h> // for open()
+#include <poll.h>
+#include <unistd.h> // for read()
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/hidraw.h>
+
+#include "helpers.h"
+#include "hid-report.h"
+
+/// Size of the receive buffer in bytes, the maximum size of a report
+#define MACRODEVICE_HIDRAW_BUFFER_SIZE 16384
+
+namespace macrodevice
+{
+	class device_hidraw;
+}
+
+/**
+ * The class for the hidraw backend
+ */
+class macrodevice::device_hidraw
+{
+	
+	private:
+		
+		/// path of the hidraw device, e.g. /dev/hidraw0
+		std::string m_path;
+		
+		/// usb vid and pid, used to find the device if no path is given
+		int m_vid = -1, m_pid = -1;
+		
+		/// file descriptor of the hidraw device
+		int m_filedesc = -1;
+		
+		/// eventfd to wake up poll(), see interrupt()
+		int m_wake = -1;
+		
+		struct pollfd m_pollfd[2];
+		
+		/// poll timeout
+		int m_timeout = -1;
+		
+		/// pass each report as payload instead of parsing it?
+		bool m_raw = false;
+		
+		/// parses the reports with the report descriptor of the device
+		macrodevice::hid_report m_report;
+		
+		/// the last report, raw events point into this buffer
+		std::vector< char > m_buffer;
+		
+		/**
+		 * Finds the hidraw device with m_vid and m_pid
+		 * @return the path of the device or an empty string
+		 */
+		std::string find_device();
+		
+		/**
+		 * Reads the report descriptor of the opened device and parses it
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int read_descriptor();
+		
+	public:
+		
+		/// with raw = true the events of this backend consist of a payload
+		static constexpr bool payload_events = true;
+		
+		/**
+		 * Loads the device settings, e.g. path
+		 * Valid settings keys are: path, vid, pid, raw, timeout
+		 * @param settings A map of settings keys to their values
+		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if required settings are missing or invalid
+		 */
+		int load_settings( const std::map< std::string, std::string > &settings );
+		
+		/**
+		 * Opens the device specified through load_settings
+		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * @see load_settings
+		 */
+		int open_device();
+		
+		/**
+		 * Closes the device opened by open_device
+		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * @see open_device
+		 */
+		int close_device();
+		
+		/**
+		 * Waits for an event, i.e. a change of the reports or a report with raw = true
+		 * @param event The received event: usage page, usage and value, or the report as payload with raw = true
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int get_pollfds( std::vector< struct pollfd > &fds );
+		
+		/**
+		 * Wakes up wait_for_event, which returns MACRODEVICE_TIMEOUT, can be called from any thread
+		 */
+		void interrupt();
+		
+};
+
+#endif
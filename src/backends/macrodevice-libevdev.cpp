@@ -43,6 +43,62 @@ int macrodevice::device_libevdev::load_settings( const std::map< std::string, st
 		{
 			m_timeout = std::stoi( settings.at( "timeout" ) );
 		}
+		if( settings.contains( "batch_size" ) )
+		{
+			m_batch_size = std::stoi( settings.at( "batch_size" ) );
+		}
+		if( settings.contains( "batch_latency" ) )
+		{
+			m_batch_latency = std::stoi( settings.at( "batch_latency" ) );
+		}
+		if( settings.contains( "filter_types" ) )
+		{
+			// type names or numbers
+			for( auto &name : macrodevice::split_list( settings.at( "filter_types" ) ) )
+			{
+				int type = std::isdigit( name[0] ) ? std::stoi( name ) : libevdev_event_type_from_name( name.c_str() );
+				if( type < 0 || type > EV_MAX )
+				{
+					return MACRODEVICE_FAILURE;
+				}
+				m_filter_types |= 1u << type;
+			}
+		}
+		if( settings.contains( "filter_codes" ) )
+		{
+			// code names, the type is determined from the name
+			for( auto &name : macrodevice::split_list( settings.at( "filter_codes" ) ) )
+			{
+				int type, code = -1;
+				for( type = 0; type <= EV_MAX && code < 0; type++ )
+				{
+					code = libevdev_event_code_from_name( type, name.c_str() );
+				}
+				type--;
+				
+				if( code < 0 )
+				{
+					return MACRODEVICE_FAILURE;
+				}
+				
+				if( m_filter_codes[type].empty() )
+				{
+					m_filter_codes[type].resize( libevdev_event_type_get_max( type ) + 1 );
+				}
+				m_filter_codes[type][code] = true;
+			}
+		}
+		if( settings.contains( "coalesce_ms" ) )
+		{
+			m_coalesce_ms = std::stoi( settings.at( "coalesce_ms" ) );
+		}
+		if( settings.contains( "filter_values" ) )
+		{
+			for( auto &value : macrodevice::split_list( settings.at( "filter_values" ) ) )
+			{
+				m_filter_values.push_back( std::stoi( value ) );
+			}
+		}
 		
 	}
 	catch( std::exception &e )
@@ -59,7 +115,7 @@ int macrodevice::device_libevdev::load_settings( const std::map< std::string, st
 int macrodevice::device_libevdev::open_device()
 {
 	// open eventfile
-	m_filedesc = open( m_eventfile_path.c_str(), O_RDONLY|O_NONBLOCK );
+	m_filedesc = open( m_eventfile_path.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC );
 	if( m_filedesc < 0 )
 	{
 		return MACRODEVICE_FAILURE;
@@ -68,9 +124,51 @@ int macrodevice::device_libevdev::open_device()
 	// create libevdev device
 	if( libevdev_new_from_fd( m_filedesc, &m_device ) < 0 )
 	{
+		close( m_filedesc );
 		return MACRODEVICE_FAILURE;
 	}
 	
+	// a reopened device starts without the events of the previous one: an incomplete frame
+	// or coalescing window would mix old events with new ones, or hold a release of a lost key
+	m_pending.clear();
+	m_pending_position = 0;
+	m_syncing = false;
+	m_frame.clear();
+	m_coalesced.clear();
+	m_ready.clear();
+	m_frame_other = false;
+	
+	// the names of events don't change, so they are looked up only once
+	if( !m_numbers )
+	{
+		for( unsigned int type = 0; type < EV_CNT; type++ )
+		{
+			m_type_names[type] = libevdev_event_type_get_name( type );
+			
+			int max = libevdev_event_type_get_max( type );
+			m_code_names[type].assign( max + 1 > 0 ? max + 1 : 0, NULL );
+			for( int code = 0; code <= max; code++ )
+				m_code_names[type][code] = libevdev_event_code_get_name( type, code );
+		}
+	}
+	
+	// use the same clock for the timestamps of events as the other backends
+	m_monotonic = libevdev_set_clock_id( m_device, CLOCK_MONOTONIC ) == 0;
+	
+	// events that don't pass the filters don't need to be read at all
+	set_kernel_mask();
+	
+	// wakes up the reactor at the end of a coalescing window
+	if( m_coalesce_ms > 0 )
+	{
+		m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+		if( m_timerfd < 0 )
+		{
+			close_device();
+			return MACRODEVICE_FAILURE;
+		}
+	}
+	
 	// set up polling
 	m_pollfd[0].fd = m_filedesc;
 	m_pollfd[0].events = POLLIN;
@@ -80,6 +178,7 @@ int macrodevice::device_libevdev::open_device()
 	{
 		if( libevdev_grab( m_device, LIBEVDEV_GRAB ) < 0 )
 		{
+			close_device();
 			return MACRODEVICE_FAILURE;
 		}
 	}
@@ -97,6 +196,13 @@ int macrodevice::device_libevdev::close_device()
 	
 	// free the device
 	libevdev_free( m_device );
+	close( m_filedesc );
+	
+	if( m_timerfd >= 0 )
+	{
+		close( m_timerfd );
+		m_timerfd = -1;
+	}
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -104,73 +210,506 @@ int macrodevice::device_libevdev::close_device()
 /**
  * @copydoc macrodevice::device_libevdev::wait_for_event
  */
-int macrodevice::device_libevdev::wait_for_event( std::vector< std::string > &event )
+int macrodevice::device_libevdev::wait_for_event( macrodevice::event &event )
 {
+	bool filtered;
+	int status;
 	
-	struct input_event libevdev_event;
+	// skip filtered events
+	do
+	{
+		status = next_event( event, m_timeout, filtered );
+	}
+	while( status == MACRODEVICE_SUCCESS && filtered );
 	
-	// wait for change in /dev/input/event* if no events are pending
-	if( libevdev_has_event_pending( m_device ) == 0 )
+	return status;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::wait_for_frame
+ */
+int macrodevice::device_libevdev::wait_for_frame( std::vector< macrodevice::event > &frame )
+{
+	macrodevice::event event;
+	bool filtered;
+	
+	// time in ms since the first event of the incomplete frame
+	auto frame_age = [this](){ return std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::steady_clock::now() - m_frame_start ).count(); };
+	
+	while( true )
 	{
-		int p = poll( m_pollfd, 1, m_timeout );
-		if( p < 0 )
+		// don't wait longer than the time left until an incomplete frame gets passed on
+		int timeout = m_timeout;
+		if( !m_frame.empty() && m_batch_latency >= 0 )
+		{
+			int remaining = std::max( 0, m_batch_latency - (int)frame_age() );
+			timeout = m_timeout < 0 ? remaining : std::min( m_timeout, remaining );
+		}
+		
+		int status = next_event( event, timeout, filtered );
+		
+		if( status == MACRODEVICE_FAILURE )
 		{
 			return MACRODEVICE_FAILURE;
 		}
-		else if( p == 0 )
+		else if( status == MACRODEVICE_TIMEOUT )
 		{
+			// pass on an incomplete frame after batch_latency, otherwise keep it for the next call
+			if( !m_frame.empty() && m_batch_latency >= 0 && frame_age() >= m_batch_latency )
+			{
+				break;
+			}
+			
 			return MACRODEVICE_TIMEOUT;
 		}
+		
+		bool syn_report = m_last_event.type == EV_SYN && m_last_event.code == SYN_REPORT;
+		
+		// a filtered SYN_REPORT still ends the frame
+		if( filtered )
+		{
+			if( syn_report && !m_frame.empty() )
+			{
+				break;
+			}
+			continue;
+		}
+		
+		if( m_frame.empty() )
+		{
+			m_frame_start = std::chrono::steady_clock::now();
+		}
+		m_frame.push_back( event );
+		
+		// the frame is complete
+		if( syn_report || ( m_batch_size > 0 && m_frame.size() >= m_batch_size ) )
+		{
+			break;
+		}
+	}
+	
+	frame.swap( m_frame );
+	m_frame.clear();
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::field_from_name
+ */
+int macrodevice::device_libevdev::field_from_name( unsigned int field, const char *name, const macrodevice::event &pattern, long long &value )
+{
+	int result = -1;
+	
+	if( field == 0 )
+		result = libevdev_event_type_from_name( name );
+	else if( field == 1 )
+		result = libevdev_event_code_from_name( pattern.value[0], name );
+	
+	if( result < 0 )
+		return MACRODEVICE_FAILURE;
+	
+	value = result;
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::next_event
+ */
+int macrodevice::device_libevdev::next_event( macrodevice::event &event, int timeout, bool &filtered )
+{
+	
+	struct input_event libevdev_event;
+	
+	int status = next_input_event( libevdev_event, timeout );
+	if( status != MACRODEVICE_SUCCESS )
+	{
+		return status;
 	}
 	
 	event.clear();
 	
-	// get event
-	if( libevdev_next_event( m_device, LIBEVDEV_READ_FLAG_NORMAL, &libevdev_event) == 0 )
+	m_last_event = libevdev_event;
+	
+	// the kernel timestamp, if it uses the same clock as the other backends
+	if( m_monotonic )
+	{
+		event.timestamp = libevdev_event.time.tv_sec * 1000000000ull + libevdev_event.time.tv_usec * 1000ull;
+	}
+	else
+	{
+		event.timestamp = macrodevice::monotonic_ns();
+	}
+	
+	filtered = !passes_filters( libevdev_event );
+	if( filtered )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	if( m_numbers )
+	{
+		event.push( libevdev_event.type );
+		event.push( libevdev_event.code );
+		event.push( libevdev_event.value );
+	}
+	else
+	{
+		// add the names from the tables, events without a name are passed as numbers
+		const char *type_name = NULL, *code_name = NULL, *value_name = NULL;
+		if( libevdev_event.type < EV_CNT )
+		{
+			type_name = m_type_names[libevdev_event.type];
+			
+			const auto &code_names = m_code_names[libevdev_event.type];
+			if( libevdev_event.code < code_names.size() )
+				code_name = code_names[libevdev_event.code];
+		}
+		
+		// only the values of a few EV_ABS codes have names (e.g. ABS_MT_TOOL_TYPE)
+		if( libevdev_event.type == EV_ABS )
+			value_name = libevdev_event_value_get_name( libevdev_event.type, libevdev_event.code, libevdev_event.value );
+		
+		event.push( libevdev_event.type, type_name );
+		event.push( libevdev_event.code, code_name );
+		event.push( libevdev_event.value, value_name );
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::read_pending
+ */
+int macrodevice::device_libevdev::read_pending()
+{
+	struct input_event libevdev_event;
+	
+	while( m_pending.size() < MACRODEVICE_LIBEVDEV_READ_SIZE )
 	{
-		if( m_numbers )
+		int status = libevdev_next_event( m_device, m_syncing ? LIBEVDEV_READ_FLAG_SYNC : LIBEVDEV_READ_FLAG_NORMAL, &libevdev_event );
+		
+		if( status == LIBEVDEV_READ_STATUS_SUCCESS )
 		{
-			event.push_back( std::to_string( libevdev_event.type ) );
-			event.push_back( std::to_string( libevdev_event.code ) );
-			event.push_back( std::to_string( libevdev_event.value ) );
+			m_pending.push_back( libevdev_event );
 		}
-		else
+		else if( status == LIBEVDEV_READ_STATUS_SYNC )
+		{
+			// the first event is the SYN_DROPPED, followed by the differences to the current state of the device, ending with a SYN_REPORT
+			m_pending.push_back( libevdev_event );
+			m_syncing = true;
+		}
+		else if( status == -EAGAIN )
 		{
+			// the resync is complete, continue with the normal events
+			if( m_syncing )
+			{
+				m_syncing = false;
+				continue;
+			}
 			
-			// add event type
-			if( libevdev_event_type_get_name( libevdev_event.type ) != NULL )
+			break;
+		}
+		else if( status == -EINTR )
+		{
+			continue;
+		}
+		else
+		{
+			// pass on the events that have been read, the error occurs again with the next read
+			return m_pending.empty() ? MACRODEVICE_FAILURE : MACRODEVICE_SUCCESS;
+		}
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::read_input_event
+ */
+int macrodevice::device_libevdev::read_input_event( struct input_event &libevdev_event, int timeout )
+{
+	// take all pending events at once, after waiting for a change in /dev/input/event*
+	if( m_pending_position >= m_pending.size() )
+	{
+		m_pending.clear();
+		m_pending_position = 0;
+		
+		// events left in the queue of libevdev (e.g. the rest of a resync) don't wake up poll
+		if( !m_syncing && libevdev_has_event_pending( m_device ) == 0 )
+		{
+			int p = poll( m_pollfd, 1, timeout );
+			if( p < 0 )
 			{
-				event.push_back( libevdev_event_type_get_name( libevdev_event.type ) );
+				return MACRODEVICE_FAILURE;
 			}
-			else
+			else if( p == 0 )
+			{
+				return MACRODEVICE_TIMEOUT;
+			}
+		}
+		
+		if( read_pending() != MACRODEVICE_SUCCESS )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		
+		if( m_pending.empty() )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+	}
+	
+	libevdev_event = m_pending[m_pending_position++];
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::next_input_event
+ */
+int macrodevice::device_libevdev::next_input_event( struct input_event &libevdev_event, int timeout )
+{
+	// time in ms since the first event of the current window
+	auto window_age = [this](){ return std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::steady_clock::now() - m_coalesce_start ).count(); };
+	
+	while( true )
+	{
+		if( !m_ready.empty() )
+		{
+			libevdev_event = m_ready.front();
+			m_ready.pop_front();
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		// pass on the merged events at the end of the window, followed by a SYN_REPORT
+		if( !m_coalesced.empty() && m_coalesce_ms > 0 && window_age() >= m_coalesce_ms )
+		{
+			struct input_event syn = m_coalesced.back();
+			syn.type = EV_SYN;
+			syn.code = SYN_REPORT;
+			syn.value = 0;
+			
+			flush_coalesced();
+			m_ready.push_back( syn );
+			continue;
+		}
+		
+		// don't wait longer than the end of the current window
+		int wait = timeout;
+		if( !m_coalesced.empty() && m_coalesce_ms > 0 )
+		{
+			int remaining = std::max( 0, m_coalesce_ms - (int)window_age() );
+			wait = timeout < 0 ? remaining : std::min( timeout, remaining );
+		}
+		
+		int status = read_input_event( libevdev_event, wait );
+		
+		if( status == MACRODEVICE_FAILURE )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		else if( status == MACRODEVICE_TIMEOUT )
+		{
+			// the window has ended
+			if( !m_coalesced.empty() && m_coalesce_ms > 0 && window_age() >= m_coalesce_ms )
 			{
-				event.push_back( std::to_string( libevdev_event.type ) );
+				continue;
 			}
 			
-			// add event code
-			if( libevdev_event_code_get_name( libevdev_event.type, libevdev_event.code ) != NULL )
+			return MACRODEVICE_TIMEOUT;
+		}
+		
+		if( m_coalesce_ms < 0 )
+		{
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		// multitouch axes are passed on unchanged, they belong to different slots
+		if( libevdev_event.type == EV_REL || ( libevdev_event.type == EV_ABS && libevdev_event.code < ABS_MT_SLOT ) )
+		{
+			coalesce( libevdev_event );
+			continue;
+		}
+		
+		if( libevdev_event.type == EV_SYN && libevdev_event.code == SYN_REPORT )
+		{
+			// merge per frame
+			if( m_coalesce_ms == 0 )
 			{
-				event.push_back( libevdev_event_code_get_name( libevdev_event.type, libevdev_event.code ) );
+				flush_coalesced();
+				m_ready.push_back( libevdev_event );
+				continue;
 			}
-			else
+			
+			// frames that only contained merged events end with the window
+			if( !m_frame_other )
 			{
-				event.push_back( std::to_string( libevdev_event.code ) );
+				continue;
 			}
 			
-			// add event value
-			if( libevdev_event_value_get_name( libevdev_event.type, libevdev_event.code, libevdev_event.value ) != NULL )
+			m_frame_other = false;
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		// keep the order of events, the merged events are passed on first
+		flush_coalesced();
+		m_frame_other = true;
+		m_ready.push_back( libevdev_event );
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::coalesce
+ */
+void macrodevice::device_libevdev::coalesce( const struct input_event &libevdev_event )
+{
+	for( auto &e : m_coalesced )
+	{
+		if( e.type == libevdev_event.type && e.code == libevdev_event.code )
+		{
+			if( e.type == EV_REL )
 			{
-				event.push_back( libevdev_event_value_get_name( libevdev_event.type, libevdev_event.code, libevdev_event.value ) );
+				e.value += libevdev_event.value;
 			}
 			else
 			{
-				event.push_back( std::to_string( libevdev_event.value ) );
+				e.value = libevdev_event.value;
 			}
+			e.time = libevdev_event.time;
 			
+			return;
 		}
+	}
+	
+	// start a new window
+	if( m_coalesced.empty() )
+	{
+		m_coalesce_start = std::chrono::steady_clock::now();
 		
-		return MACRODEVICE_SUCCESS;
+		if( m_timerfd >= 0 )
+		{
+			struct itimerspec expire = {};
+			expire.it_value.tv_sec = m_coalesce_ms / 1000;
+			expire.it_value.tv_nsec = ( m_coalesce_ms % 1000 ) * 1000000L;
+			timerfd_settime( m_timerfd, 0, &expire, NULL );
+		}
+	}
+	
+	m_coalesced.push_back( libevdev_event );
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::flush_coalesced
+ */
+void macrodevice::device_libevdev::flush_coalesced()
+{
+	m_ready.insert( m_ready.end(), m_coalesced.begin(), m_coalesced.end() );
+	m_coalesced.clear();
+	
+	// disarm the timer and clear its expiration
+	if( m_timerfd >= 0 )
+	{
+		struct itimerspec disarm = {};
+		timerfd_settime( m_timerfd, 0, &disarm, NULL );
+		
+		uint64_t expirations;
+		if( read( m_timerfd, &expirations, sizeof( expirations ) ) < 0 )
+		{
+			// not expired yet
+		}
+	}
+}
+
+
+/**
+ * @copydoc macrodevice::device_libevdev::passes_filters
+ */
+bool macrodevice::device_libevdev::passes_filters( const struct input_event &event ) const
+{
+	if( m_filter_types != 0 && !( m_filter_types & ( 1u << event.type ) ) )
+	{
+		return false;
+	}
+	
+	auto &codes = m_filter_codes[event.type];
+	if( !codes.empty() && ( event.code >= codes.size() || !codes[event.code] ) )
+	{
+		return false;
+	}
+	
+	if( event.type == EV_KEY && !m_filter_values.empty() &&
+		std::find( m_filter_values.begin(), m_filter_values.end(), event.value ) == m_filter_values.end() )
+	{
+		return false;
+	}
+	
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::set_kernel_mask
+ */
+void macrodevice::device_libevdev::set_kernel_mask()
+{
+	#ifdef EVIOCSMASK
+	struct input_mask mask;
+	
+	// mask of the types, the type EV_SYN selects the type mask
+	if( m_filter_types != 0 )
+	{
+		uint8_t types[( EV_CNT + 7 ) / 8] = {0};
+		for( unsigned int type = 0; type < EV_CNT; type++ )
+		{
+			if( type == EV_SYN || ( m_filter_types & ( 1u << type ) ) )
+			{
+				types[type / 8] |= 1 << ( type % 8 );
+			}
+		}
+		
+		mask.type = EV_SYN;
+		mask.codes_size = sizeof( types );
+		mask.codes_ptr = (uint64_t)(uintptr_t)types;
+		ioctl( m_filedesc, EVIOCSMASK, &mask ); // ignore failure, the events still get filtered after reading
 	}
 	
-	return MACRODEVICE_FAILURE;
+	// mask of the codes of each type
+	for( unsigned int type = 1; type < EV_CNT; type++ )
+	{
+		if( m_filter_codes[type].empty() )
+		{
+			continue;
+		}
+		
+		std::vector< uint8_t > codes( ( m_filter_codes[type].size() + 7 ) / 8, 0 );
+		for( unsigned int code = 0; code < m_filter_codes[type].size(); code++ )
+		{
+			if( m_filter_codes[type][code] )
+			{
+				codes[code / 8] |= 1 << ( code % 8 );
+			}
+		}
+		
+		mask.type = type;
+		mask.codes_size = codes.size();
+		mask.codes_ptr = (uint64_t)(uintptr_t)codes.data();
+		ioctl( m_filedesc, EVIOCSMASK, &mask );
+	}
+	#endif
+}
+
+/**
+ * @copydoc macrodevice::device_libevdev::get_pollfds
+ */
+int macrodevice::device_libevdev::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	fds.push_back( { m_filedesc, POLLIN, 0 } );
+	
+	// the end of a coalescing window
+	if( m_timerfd >= 0 )
+	{
+		fds.push_back( { m_timerfd, POLLIN, 0 } );
+	}
+	
+	return MACRODEVICE_SUCCESS;
 }
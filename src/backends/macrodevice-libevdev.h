@@ -26,16 +26,28 @@
 #include <map>
 #include <string>
 #include <exception>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <cstdint>
+#include <cerrno>
 
 #include <sys/types.h> // for open()
 #include <sys/stat.h> // for open()
 #include <fcntl.h> // for open()
 #include <poll.h>
+#include <sys/ioctl.h> // for EVIOCSMASK
+#include <sys/timerfd.h>
+#include <unistd.h> // for close()
 
 #include <libevdev-1.0/libevdev/libevdev.h>
 
 #include "helpers.h"
 
+/// Maximum number of events taken from the device per wakeup
+#define MACRODEVICE_LIBEVDEV_READ_SIZE 1024
+
 namespace macrodevice
 {
 	class device_libevdev;
@@ -68,12 +80,122 @@ class macrodevice::device_libevdev
 
 		/// poll timeout
 		int m_timeout = -1;
+		
+		/// the names of all event types and codes, indexed by type (and code), looked up once by open_device unless m_numbers is set
+		std::array< const char*, EV_CNT > m_type_names = {};
+		std::array< std::vector< const char* >, EV_CNT > m_code_names;
+		
+		/// the last event received by next_event
+		struct input_event m_last_event;
+		
+		/// are the timestamps of the kernel from CLOCK_MONOTONIC?
+		bool m_monotonic = false;
+		
+		/// maximum number of events in a frame, 0 for no limit
+		unsigned int m_batch_size = 0;
+		
+		/// maximum time in ms between the first event of a frame and passing on the frame, -1 for no limit
+		int m_batch_latency = -1;
+		
+		/// the incomplete frame, kept between calls of wait_for_frame
+		std::vector< macrodevice::event > m_frame;
+		
+		/// time of the first event in m_frame
+		std::chrono::steady_clock::time_point m_frame_start;
+		
+		/// only pass events of these types, bit n for type n, all types if 0
+		uint32_t m_filter_types = 0;
+		
+		/// only pass these codes, for each type, all codes of a type if its vector is empty
+		std::array< std::vector< bool >, EV_CNT > m_filter_codes;
+		
+		/// only pass EV_KEY events with these values, all values if empty
+		std::vector< int > m_filter_values;
+		
+		/// time window in ms for merging EV_REL and EV_ABS events, 0 to merge per frame, -1 to disable
+		int m_coalesce_ms = -1;
+		
+		/// the merged events of the current window, one per axis
+		std::vector< struct input_event > m_coalesced;
+		
+		/// time of the first event in m_coalesced
+		std::chrono::steady_clock::time_point m_coalesce_start;
+		
+		/// events ready to be returned by next_input_event
+		std::deque< struct input_event > m_ready;
+		
+		/// does the current frame contain an event that hasn't been merged?
+		bool m_frame_other = false;
+		
+		/// expires at the end of the window, so that the reactor wakes up, -1 if coalesce_ms <= 0
+		int m_timerfd = -1;
+		
+		/// the events taken from the device by read_pending, m_pending[m_pending_position] is the next one
+		std::vector< struct input_event > m_pending;
+		size_t m_pending_position = 0;
+		
+		/// are the events of a resync being read? see read_pending
+		bool m_syncing = false;
+		
+		/**
+		 * Takes all events that are pending on the device and appends them to m_pending, without waiting.
+		 * After events have been dropped by the kernel (SYN_DROPPED), the events that bring the state of the
+		 * device up to date (e.g. key releases) are read as well, so that no key stays pressed.
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int read_pending();
+		
+		/**
+		 * Reads the next event from the device
+		 * @param libevdev_event The received event
+		 * @param timeout Poll timeout in ms
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int read_input_event( struct input_event &libevdev_event, int timeout );
+		
+		/**
+		 * Reads the next event, with EV_REL and EV_ABS events merged according to coalesce_ms
+		 * @param libevdev_event The received event
+		 * @param timeout Poll timeout in ms
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int next_input_event( struct input_event &libevdev_event, int timeout );
+		
+		/**
+		 * Adds an EV_REL or EV_ABS event to the current window: relative values are summed, the latest absolute value is kept
+		 */
+		void coalesce( const struct input_event &libevdev_event );
+		
+		/**
+		 * Moves the merged events to m_ready and starts a new window
+		 */
+		void flush_coalesced();
+		
+		/**
+		 * Waits for an event with the given timeout
+		 * @param event The received event, not set if the event has been filtered
+		 * @param timeout Poll timeout in ms
+		 * @param filtered Set to true if the event doesn't pass the filters
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int next_event( macrodevice::event &event, int timeout, bool &filtered );
+		
+		/**
+		 * Checks if an event passes filter_types, filter_codes and filter_values
+		 */
+		bool passes_filters( const struct input_event &event ) const;
+		
+		/**
+		 * Sets the event mask of the kernel from filter_types and filter_codes, so that other events never get read
+		 * Does nothing if the kernel doesn't support EVIOCSMASK, EV_SYN never gets masked
+		 */
+		void set_kernel_mask();
 
 	public:
 		
 		/**
 		 * Loads the device settings, e.g. eventfile
-		 * Valid settings keys are: eventfile
+		 * Valid settings keys are: eventfile, grab, numbers, timeout, batch_size, batch_latency, filter_types, filter_codes, filter_values, coalesce_ms
 		 * @param settings A map of settings keys to their values
 		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
 		 */
@@ -98,7 +220,32 @@ class macrodevice::device_libevdev
 		 * @param event The received event, typically of size == 3
 		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
 		 */
-		int wait_for_event( std::vector< std::string > &event );
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Waits for a frame of events, i.e. all events up to and including a SYN_REPORT
+		 * The frame ends early if it reaches batch_size events or batch_latency ms
+		 * @param frame The received events
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_frame( std::vector< macrodevice::event > &frame );
+		
+		/**
+		 * Converts the name of an event field to its value, used for bindings
+		 * @param field The index of the field: 0 for the type, 1 for the code
+		 * @param name The name, e.g. "EV_KEY" or "KEY_A"
+		 * @param pattern The preceding fields
+		 * @param value The value of the field
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		static int field_from_name( unsigned int field, const char *name, const macrodevice::event &pattern, long long &value );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int get_pollfds( std::vector< struct pollfd > &fds );
 		
 };
 
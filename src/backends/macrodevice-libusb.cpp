@@ -74,6 +74,26 @@ int macrodevice::device_libusb::load_settings( const std::map< std::string, std:
 			}
 		}
 		
+		// number of transfers in flight and timeout (optional)
+		if( settings.find( "transfers" ) != settings.end() )
+		{
+			m_num_transfers = std::stoi( settings.at("transfers") );
+			if( m_num_transfers < 1 )
+			{
+				return MACRODEVICE_FAILURE;
+			}
+		}
+		if( settings.find( "timeout" ) != settings.end() )
+		{
+			m_timeout = std::stoi( settings.at("timeout") );
+		}
+		
+		// press and release events for all keys (optional)
+		if( settings.find( "diff" ) != settings.end() )
+		{
+			m_diff = macrodevice::string_to_bool( settings.at( "diff" ), false );
+		}
+		
 	}
 	catch( std::exception &e )
 	{
@@ -89,20 +109,25 @@ int macrodevice::device_libusb::load_settings( const std::map< std::string, std:
 int macrodevice::device_libusb::open_device()
 {
 	// libusb init
-	if( libusb_init( NULL ) < 0 )
+	if( libusb_init( &m_context ) < 0 )
 	{
+		m_context = NULL;
 		return MACRODEVICE_FAILURE;
 	}
 	
+	// each failed attempt to open the device (e.g. while it is being reconnected) has to free the context again
+	m_device = NULL;
+	
 	// open device
 	if( m_use_bus_device )
 	{
 		// open with bus and device
 		libusb_device **dev_list; // device list
-		ssize_t num_devs = libusb_get_device_list(NULL, &dev_list); //get device list
+		ssize_t num_devs = libusb_get_device_list(m_context, &dev_list); //get device list
 		
 		if( num_devs < 0 )
 		{
+			close_device();
 			return MACRODEVICE_FAILURE;
 		}
 		
@@ -115,12 +140,9 @@ int macrodevice::device_libusb::open_device()
 				// open device
 				if( libusb_open( dev_list[i], &m_device ) != 0 )
 				{
-					return MACRODEVICE_FAILURE;
-				}
-				else
-				{
-					break;
+					m_device = NULL;
 				}
+				break;
 			}
 		}
 		
@@ -130,14 +152,17 @@ int macrodevice::device_libusb::open_device()
 	else
 	{
 		// open with vid and pid
-		m_device = libusb_open_device_with_vid_pid( NULL, m_vid, m_pid );
-		if( !m_device )
-		{
-			return MACRODEVICE_FAILURE;
-		}
+		m_device = libusb_open_device_with_vid_pid( m_context, m_vid, m_pid );
+	}
+	
+	if( !m_device )
+	{
+		close_device();
+		return MACRODEVICE_FAILURE;
 	}
 	
 	// detach kernel driver on interface 0 if active 
+	m_detached_kernel_driver = false;
 	if( libusb_kernel_driver_active( m_device, 0 ) )
 	{
 		if( libusb_detach_kernel_driver( m_device, 0 ) == 0 )
@@ -146,6 +171,7 @@ int macrodevice::device_libusb::open_device()
 		}
 		else
 		{
+			close_device();
 			return MACRODEVICE_FAILURE;
 		}
 	}
@@ -153,9 +179,37 @@ int macrodevice::device_libusb::open_device()
 	// claim interface 0
 	if( libusb_claim_interface( m_device, 0 ) != 0 )
 	{
+		close_device();
 		return MACRODEVICE_FAILURE;
 	}
 	
+	// keep several transfers on endpoint 1 submitted, so that no report gets lost while one is being handled
+	m_reports.clear();
+	m_last_key = 0;
+	m_report.reset();
+	m_failed = false;
+	m_buffers.assign( m_num_transfers, std::vector< unsigned char >( MACRODEVICE_LIBUSB_REPORT_SIZE ) );
+	
+	for( int i = 0; i < m_num_transfers; i++ )
+	{
+		struct libusb_transfer *transfer = libusb_alloc_transfer( 0 );
+		if( !transfer )
+		{
+			close_device();
+			return MACRODEVICE_FAILURE;
+		}
+		m_transfers.push_back( transfer );
+		
+		libusb_fill_interrupt_transfer( transfer, m_device, 0x81, m_buffers[i].data(), MACRODEVICE_LIBUSB_REPORT_SIZE, transfer_callback, this, 0 );
+		
+		if( libusb_submit_transfer( transfer ) != 0 )
+		{
+			close_device();
+			return MACRODEVICE_FAILURE;
+		}
+		m_in_flight++;
+	}
+	
 	return MACRODEVICE_SUCCESS;
 }
 
@@ -164,8 +218,34 @@ int macrodevice::device_libusb::open_device()
  */
 int macrodevice::device_libusb::close_device()
 {
+	// the context of a device that couldn't be opened
 	if( m_device == NULL )
+	{
+		if( m_context )
+			libusb_exit( m_context );
+		m_context = NULL;
+		
 		return MACRODEVICE_FAILURE;
+	}
+	
+	// cancel the transfers, they can only be freed after their callback has run
+	for( auto transfer : m_transfers )
+	{
+		libusb_cancel_transfer( transfer );
+	}
+	
+	for( int i = 0; i < 100 && m_in_flight > 0; i++ )
+	{
+		struct timeval timeout = { 0, 10000 };
+		libusb_handle_events_timeout_completed( m_context, &timeout, NULL );
+	}
+	
+	for( auto transfer : m_transfers )
+	{
+		libusb_free_transfer( transfer );
+	}
+	m_transfers.clear();
+	m_in_flight = 0;
 	
 	// release interface 0
 	libusb_release_interface( m_device, 0 );
@@ -176,8 +256,12 @@ int macrodevice::device_libusb::close_device()
 		libusb_attach_kernel_driver( m_device, 0 );
 	}
 	
+	libusb_close( m_device );
+	m_device = NULL;
+	
 	// exit libusb
-	libusb_exit( NULL );
+	libusb_exit( m_context );
+	m_context = NULL;
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -185,36 +269,145 @@ int macrodevice::device_libusb::close_device()
 /**
  * @copydoc macrodevice::device_libusb::wait_for_event
  */
-int macrodevice::device_libusb::wait_for_event( std::vector< std::string > &event )
+int macrodevice::device_libusb::wait_for_event( macrodevice::event &event )
 {
-	uint8_t buffer[8]; // usb data buffer
-	unsigned char key_old=0, key_new=0;
-	int transferred; // number of bytes transferred
+	bool waited = false;
 	
-	while( 1 )
+	while( true )
 	{
+		// the remaining changes of the last report
+		if( m_diff && m_report.next_change( event ) )
+		{
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		// handle the received reports
+		while( !m_reports.empty() )
+		{
+			const report &r = m_reports.front();
+			
+			if( m_diff )
+			{
+				m_report.update( r.data, r.size, r.timestamp );
+				m_reports.pop_front();
+				
+				if( m_report.next_change( event ) )
+					return MACRODEVICE_SUCCESS;
+				
+				continue;
+			}
+			
+			unsigned char key_old = m_last_key;
+			m_last_key = r.size > 2 ? r.data[2] : 0;
+			
+			// if key is pressed
+			if( key_old == 0 && m_last_key != 0 )
+			{
+				event.clear();
+				event.timestamp = r.timestamp;
+				event.push( r.data[0] );
+				event.push( r.data[2] );
+				
+				m_reports.pop_front();
+				return MACRODEVICE_SUCCESS;
+			}
+			
+			m_reports.pop_front();
+		}
 		
-		// read from endpoint 1
-		if( libusb_interrupt_transfer( m_device, 0x81, buffer, 8, &transferred, -1 ) != 0 || transferred == 0 )
+		if( m_failed )
 		{
 			return MACRODEVICE_FAILURE;
 		}
 		
+		if( waited )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
 		
-		key_old = key_new;
-		key_new = buffer[2];
+		// run the callbacks of completed transfers
+		int status;
+		if( m_timeout < 0 )
+		{
+			status = libusb_handle_events_completed( m_context, NULL );
+		}
+		else
+		{
+			struct timeval timeout = { m_timeout / 1000, ( m_timeout % 1000 ) * 1000 };
+			status = libusb_handle_events_timeout_completed( m_context, &timeout, NULL );
+		}
 		
-		// if key is pressed
-		if( key_old == 0 && key_new != 0 )
+		if( status < 0 && status != LIBUSB_ERROR_INTERRUPTED && status != LIBUSB_ERROR_TIMEOUT )
 		{
-			
-			event.clear();
-			event.push_back( std::to_string( buffer[0] ) );
-			event.push_back( std::to_string( buffer[2] ) );
-			break;
+			return MACRODEVICE_FAILURE;
 		}
 		
+		waited = true;
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_libusb::interrupt
+ */
+void macrodevice::device_libusb::interrupt()
+{
+	if( m_context )
+	{
+		libusb_interrupt_event_handler( m_context );
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_libusb::transfer_callback
+ */
+void macrodevice::device_libusb::transfer_callback( struct libusb_transfer *transfer )
+{
+	auto device = static_cast< macrodevice::device_libusb* >( transfer->user_data );
+	
+	if( transfer->status == LIBUSB_TRANSFER_COMPLETED )
+	{
+		if( transfer->actual_length > 0 )
+		{
+			report r;
+			r.timestamp = macrodevice::monotonic_ns();
+			r.size = transfer->actual_length;
+			memcpy( r.data, transfer->buffer, r.size );
+			device->m_reports.push_back( r );
+		}
+		
+		// submit the transfer again right away, the report gets handled later
+		if( libusb_submit_transfer( transfer ) == 0 )
+		{
+			return;
+		}
+		
+		device->m_failed = true;
+	}
+	else if( transfer->status != LIBUSB_TRANSFER_CANCELLED )
+	{
+		device->m_failed = true;
+	}
+	
+	device->m_in_flight--;
+}
+
+/**
+ * @copydoc macrodevice::device_libusb::get_pollfds
+ */
+int macrodevice::device_libusb::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	// libusb only adds or removes file descriptors when devices are opened or closed, the set is stable while the device is open
+	const struct libusb_pollfd **pollfds = libusb_get_pollfds( m_context );
+	if( pollfds == NULL )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	for( int i = 0; pollfds[i] != NULL; i++ )
+	{
+		fds.push_back( { pollfds[i]->fd, pollfds[i]->events, 0 } );
 	}
+	libusb_free_pollfds( pollfds );
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -24,12 +24,22 @@
 
 #include <vector>
 #include <map>
+#include <deque>
 #include <string>
 #include <exception>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/time.h> // for struct timeval
+#include <poll.h>
 
 #include <libusb-1.0/libusb.h>
 
 #include "helpers.h"
+#include "boot-report.h"
+
+/// Size of the buffer of each transfer, larger than any report of a low or full speed interrupt endpoint
+#define MACRODEVICE_LIBUSB_REPORT_SIZE 64
 
 namespace macrodevice
 {
@@ -44,6 +54,9 @@ class macrodevice::device_libusb
 	
 	private:
 		
+		/// each device has its own libusb context, so that closing one device doesn't affect the others
+		libusb_context *m_context = NULL;
+		
 		libusb_device_handle *m_device = NULL;
 		
 		bool m_detached_kernel_driver = false;
@@ -54,11 +67,52 @@ class macrodevice::device_libusb
 		bool m_use_bus_device = false;
 		int m_bus_id = 0, m_device_address = 0;
 		
+		/// number of transfers that are submitted at the same time
+		int m_num_transfers = 4;
+		
+		/// timeout of wait_for_event in ms, -1 for no timeout
+		int m_timeout = -1;
+		
+		/// the transfers and their buffers
+		std::vector< struct libusb_transfer* > m_transfers;
+		std::vector< std::vector< unsigned char > > m_buffers;
+		
+		/// number of submitted transfers that haven't completed
+		int m_in_flight = 0;
+		
+		/// set when a transfer failed, e.g. because the device has been unplugged
+		bool m_failed = false;
+		
+		/// a report received by a transfer
+		struct report
+		{
+			uint64_t timestamp;
+			int size;
+			unsigned char data[MACRODEVICE_LIBUSB_REPORT_SIZE];
+		};
+		
+		/// received reports that haven't been handled by wait_for_event
+		std::deque< report > m_reports;
+		
+		/// the key of the last report, to detect key presses
+		unsigned char m_last_key = 0;
+		
+		/// pass press and release events for all keys and modifiers?
+		bool m_diff = false;
+		
+		/// compares the reports with diff = true
+		macrodevice::boot_report m_report;
+		
+		/**
+		 * Called by libusb when a transfer has completed, stores the report and submits the transfer again
+		 */
+		static void transfer_callback( struct libusb_transfer *transfer );
+		
 	public:
 		
 		/**
 		 * Loads the device settings, e.g. USB VID, USB PID
-		 * Valid settings keys are: vid, pid
+		 * Valid settings keys are: vid, pid, use_bus_device, bus, device, transfers, timeout, diff
 		 * @param settings A map of settings keys to their values
 		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if required settings are missing or invalid
 		 */
@@ -80,10 +134,23 @@ class macrodevice::device_libusb
 		
 		/**
 		 * Waits for an event, i.e. keypress to occur
-		 * @param event The received event, typically of size == 2
-		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * @param event The received event, of size 2, or 3 with diff = true
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Makes a wait_for_event in another thread return immediately, used when closing the device
+		 */
+		void interrupt();
+		
+		/**
+		 * Gets the file descriptors libusb uses for the transfers, used by the reactor
+		 * With timeout = 0 (set by the reactor), wait_for_event only handles the completed transfers without blocking.
+		 * @param fds The file descriptors and their events (POLLIN, POLLOUT) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
 		 */
-		int wait_for_event( std::vector< std::string > &event );
+		int get_pollfds( std::vector< struct pollfd > &fds );
 		
 };
 
@@ -0,0 +1,325 @@
+/*
+ * macrodevice-replay.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "macrodevice-replay.h"
+
+/**
+ * @copydoc macrodevice::device_replay::load_settings
+ */
+int macrodevice::device_replay::load_settings( const std::map< std::string, std::string > &settings )
+{
+	
+	// read settings
+	try
+	{
+		m_file_path = settings.at( "file" );
+		
+		if( settings.contains( "timing" ) )
+		{
+			if( settings.at( "timing" ) == "original" )
+				m_original_timing = true;
+			else if( settings.at( "timing" ) == "fast" )
+				m_original_timing = false;
+			else
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "loop" ) )
+		{
+			m_loop = macrodevice::string_to_bool( settings.at( "loop" ), false );
+		}
+		if( settings.contains( "timeout" ) )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
+		
+	}
+	catch( std::exception &e )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::open_device
+ */
+int macrodevice::device_replay::open_device()
+{
+	// map the event log
+	int filedesc = open( m_file_path.c_str(), O_RDONLY|O_CLOEXEC );
+	if( filedesc < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	struct stat file_stat;
+	if( fstat( filedesc, &file_stat ) < 0 || file_stat.st_size < MACRODEVICE_LOG_MAGIC_SIZE )
+	{
+		close( filedesc );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_log_size = file_stat.st_size;
+	void *log = mmap( NULL, m_log_size, PROT_READ, MAP_PRIVATE, filedesc, 0 );
+	close( filedesc );
+	
+	if( log == MAP_FAILED )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	m_log = static_cast< const char* >( log );
+	madvise( log, m_log_size, MADV_SEQUENTIAL );
+	
+	if( memcmp( m_log, MACRODEVICE_LOG_MAGIC, MACRODEVICE_LOG_MAGIC_SIZE ) != 0 )
+	{
+		close_device();
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+	if( m_timerfd < 0 )
+	{
+		close_device();
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_wake = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+	if( m_wake < 0 )
+	{
+		close_device();
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// set up polling
+	m_pollfd[0].fd = m_timerfd;
+	m_pollfd[0].events = POLLIN;
+	m_pollfd[1].fd = m_wake;
+	m_pollfd[1].events = POLLIN;
+	
+	// schedule the first event
+	m_has_next = read_next();
+	set_timer();
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::close_device
+ */
+int macrodevice::device_replay::close_device()
+{
+	if( m_log )
+	{
+		munmap( (void*)m_log, m_log_size );
+		m_log = NULL;
+	}
+	
+	if( m_timerfd >= 0 )
+	{
+		close( m_timerfd );
+		m_timerfd = -1;
+	}
+	
+	if( m_wake >= 0 )
+	{
+		close( m_wake );
+		m_wake = -1;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::wait_for_event
+ */
+int macrodevice::device_replay::wait_for_event( macrodevice::event &event )
+{
+	// wait until the event is due, at the end of the log only until the device gets closed
+	if( !m_has_next || macrodevice::monotonic_ns() < m_next_due )
+	{
+		int p = poll( m_pollfd, 2, m_timeout );
+		if( p < 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		else if( m_pollfd[1].revents & POLLIN )
+		{
+			uint64_t value;
+			if( read( m_wake, &value, sizeof( value ) ) < 0 )
+			{
+				// already reset
+			}
+			return MACRODEVICE_TIMEOUT;
+		}
+		else if( p == 0 || !m_has_next || macrodevice::monotonic_ns() < m_next_due )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+	}
+	
+	event = m_next;
+	event.timestamp = m_next_due;
+	
+	m_has_next = read_next();
+	
+	// start again at the beginning
+	if( !m_has_next && m_loop )
+	{
+		m_position = 0;
+		m_started = false;
+		m_has_next = read_next();
+	}
+	
+	// setting the timer also clears its expiration
+	set_timer();
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::read_next
+ */
+bool macrodevice::device_replay::read_next()
+{
+	while( m_position < m_log_size )
+	{
+		const char *record = m_log + m_position;
+		size_t remaining = m_log_size - m_position;
+		
+		// the start of a session, its timestamps are unrelated to those of the previous session (e.g. recorded hours later),
+		// so the first event of the session is due immediately and becomes the new base for the timing
+		if( remaining >= MACRODEVICE_LOG_MAGIC_SIZE && memcmp( record, MACRODEVICE_LOG_MAGIC, MACRODEVICE_LOG_MAGIC_SIZE ) == 0 )
+		{
+			m_names.clear();
+			m_started = false;
+			m_position += MACRODEVICE_LOG_MAGIC_SIZE;
+		}
+		else if( record[0] == MACRODEVICE_LOG_NAME )
+		{
+			macrodevice::log_name name;
+			if( remaining < sizeof( name ) )
+				return false;
+			memcpy( &name, record, sizeof( name ) );
+			
+			if( remaining < sizeof( name ) + name.length || name.length == 0 || record[sizeof( name ) + name.length - 1] != '\0' )
+				return false;
+			
+			if( name.index >= m_names.size() )
+				m_names.resize( name.index + 1, NULL );
+			m_names[name.index] = record + sizeof( name );
+			
+			m_position += sizeof( name ) + name.length;
+		}
+		else if( record[0] == MACRODEVICE_LOG_EVENT )
+		{
+			macrodevice::log_event header;
+			if( remaining < sizeof( header ) )
+				return false;
+			memcpy( &header, record, sizeof( header ) );
+			
+			size_t size = sizeof( header ) + header.size * sizeof( macrodevice::log_field ) + header.payload_size;
+			if( remaining < size || header.size > MACRODEVICE_EVENT_SIZE )
+				return false;
+			
+			m_next.clear();
+			const char *fields = record + sizeof( header );
+			for( unsigned int i = 0; i < header.size; i++ )
+			{
+				macrodevice::log_field field;
+				memcpy( &field, fields + i * sizeof( field ), sizeof( field ) );
+				m_next.push( field.value, field.name < m_names.size() ? m_names[field.name] : NULL );
+			}
+			
+			if( header.has_payload )
+			{
+				m_next.payload = fields + header.size * sizeof( macrodevice::log_field );
+				m_next.payload_size = header.payload_size;
+			}
+			
+			// the time the event is due
+			uint64_t now = macrodevice::monotonic_ns();
+			if( !m_started )
+			{
+				m_started = true;
+				m_first_recorded = header.timestamp;
+				m_first_replayed = now;
+			}
+			
+			if( m_original_timing && header.timestamp >= m_first_recorded )
+				m_next_due = m_first_replayed + ( header.timestamp - m_first_recorded );
+			else
+				m_next_due = now;
+			
+			m_position += size;
+			return true;
+		}
+		else
+		{
+			// invalid record
+			return false;
+		}
+	}
+	
+	return false;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::set_timer
+ */
+void macrodevice::device_replay::set_timer()
+{
+	struct itimerspec timer = {};
+	
+	if( m_has_next )
+	{
+		// an absolute time in the past expires immediately, 0 would disarm the timer
+		uint64_t due = m_next_due > 0 ? m_next_due : 1;
+		timer.it_value.tv_sec = due / 1000000000;
+		timer.it_value.tv_nsec = due % 1000000000;
+	}
+	
+	timerfd_settime( m_timerfd, TFD_TIMER_ABSTIME, &timer, NULL );
+}
+
+/**
+ * @copydoc macrodevice::device_replay::get_pollfds
+ */
+int macrodevice::device_replay::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	fds.push_back( { m_timerfd, POLLIN, 0 } );
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_replay::interrupt
+ */
+void macrodevice::device_replay::interrupt()
+{
+	if( m_wake >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wake, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, wait_for_event gets woken up anyway
+		}
+	}
+}
@@ -0,0 +1,155 @@
+/*
+ * macrodevice-replay.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_REPLAY
+#define MACRODEVICE_REPLAY
+
+#include <vector>
+#include <map>
+#include <string>
+#include <exception>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/types.h> // for open()
+#include <sys/stat.h> // for open()
+#include <fcntl.h> // for open()
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h> // for close()
+
+#include "helpers.h"
+#include "event-log.h"
+
+namespace macrodevice
+{
+	class device_replay;
+}
+
+/**
+ * The class for the replay backend, replays an event log written by the record setting
+ */
+class macrodevice::device_replay
+{
+	
+	private:
+		
+		/// path of the event log
+		std::string m_file_path;
+		
+		/// keep the time between events as recorded? otherwise replay as fast as possible
+		bool m_original_timing = true;
+		
+		/// start again at the beginning after the last event?
+		bool m_loop = false;
+		
+		/// poll timeout
+		int m_timeout = -1;
+		
+		/// the mapped event log
+		const char *m_log = NULL;
+		size_t m_log_size = 0;
+		
+		/// position of the next record in m_log
+		size_t m_position = 0;
+		
+		/// the names of the current session, pointing into m_log
+		std::vector< const char* > m_names;
+		
+		/// expires when the next event is due
+		int m_timerfd = -1;
+		
+		/// eventfd to wake up poll(), see interrupt()
+		int m_wake = -1;
+		
+		struct pollfd m_pollfd[2];
+		
+		/// recorded timestamp of the first event, and the time it has been replayed
+		uint64_t m_first_recorded = 0, m_first_replayed = 0;
+		bool m_started = false;
+		
+		/// the next event, valid if m_has_next is true
+		macrodevice::event m_next;
+		bool m_has_next = false;
+		
+		/// replay time of m_next in ns of CLOCK_MONOTONIC
+		uint64_t m_next_due = 0;
+		
+		/**
+		 * Reads records until the next event record
+		 * @return false at the end of the log or if the log is invalid
+		 */
+		bool read_next();
+		
+		/**
+		 * Sets the timer to the time m_next is due
+		 */
+		void set_timer();
+		
+	public:
+		
+		/**
+		 * Loads the device settings, e.g. file
+		 * Valid settings keys are: file, timing, loop, timeout
+		 * @param settings A map of settings keys to their values
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int load_settings( const std::map< std::string, std::string > &settings );
+		
+		/**
+		 * Maps the event log specified through load_settings
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 * @see load_settings
+		 */
+		int open_device();
+		
+		/**
+		 * Unmaps the event log
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 * @see open_device
+		 */
+		int close_device();
+		
+		/**
+		 * Waits for the next event of the log to be due
+		 * @param event The event, its timestamp is the time it was due
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int get_pollfds( std::vector< struct pollfd > &fds );
+		
+		/**
+		 * Wakes up wait_for_event, which returns MACRODEVICE_TIMEOUT, can be called from any thread
+		 * Without it, a device that has replayed the whole log (loop = false) could only be closed after the timeout
+		 */
+		void interrupt();
+		
+};
+
+#endif
@@ -31,6 +31,107 @@ int macrodevice::device_serial::load_settings( const std::map< std::string, std:
 	{
 		m_port_path = settings.at( "port" );
 		
+		if( settings.contains( "timeout" ) )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
+		if( settings.contains( "delimiter" ) )
+		{
+			if( settings.at( "delimiter" ).size() != 1 )
+				return MACRODEVICE_FAILURE;
+			
+			m_delimiter = settings.at( "delimiter" ).at( 0 );
+		}
+		if( settings.contains( "strip_cr" ) )
+		{
+			m_strip_cr = macrodevice::string_to_bool( settings.at( "strip_cr" ), true );
+		}
+		if( settings.contains( "framing" ) )
+		{
+			if( settings.at( "framing" ) == "delimiter" )
+				m_framing = framing::delimiter;
+			else if( settings.at( "framing" ) == "cobs" )
+				m_framing = framing::cobs;
+			else if( settings.at( "framing" ) == "length" )
+				m_framing = framing::length;
+			else
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "length_size" ) )
+		{
+			m_length_size = std::stoi( settings.at( "length_size" ) );
+			if( m_length_size != 1 && m_length_size != 2 && m_length_size != 4 )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "unpack" ) )
+		{
+			// e.g. "u8, i16, i16"
+			const std::map< std::string, field_format > formats = {
+				{ "u8", { 1, false } }, { "i8", { 1, true } },
+				{ "u16", { 2, false } }, { "i16", { 2, true } },
+				{ "u32", { 4, false } }, { "i32", { 4, true } },
+				{ "i64", { 8, true } }
+			};
+			
+			m_unpack.clear();
+			for( auto &f : macrodevice::split_list( settings.at( "unpack" ) ) )
+				m_unpack.push_back( formats.at( f ) );
+			
+			if( m_unpack.empty() || m_unpack.size() > MACRODEVICE_EVENT_SIZE )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "baud" ) )
+		{
+			const std::map< int, speed_t > rates = {
+				{ 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+				{ 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+				{ 230400, B230400 }, { 460800, B460800 }, { 500000, B500000 }, { 576000, B576000 },
+				{ 921600, B921600 }, { 1000000, B1000000 }, { 1152000, B1152000 }, { 1500000, B1500000 },
+				{ 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 }, { 3500000, B3500000 },
+				{ 4000000, B4000000 }
+			};
+			
+			m_baud = rates.at( std::stoi( settings.at( "baud" ) ) );
+		}
+		if( settings.contains( "data_bits" ) )
+		{
+			m_data_bits = std::stoi( settings.at( "data_bits" ) );
+			if( m_data_bits < 5 || m_data_bits > 8 )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "parity" ) )
+		{
+			m_parity = settings.at( "parity" );
+			if( m_parity != "none" && m_parity != "even" && m_parity != "odd" )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "stop_bits" ) )
+		{
+			m_stop_bits = std::stoi( settings.at( "stop_bits" ) );
+			if( m_stop_bits != 1 && m_stop_bits != 2 )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "raw" ) )
+		{
+			m_raw = macrodevice::string_to_bool( settings.at( "raw" ), false );
+		}
+		if( settings.contains( "vmin" ) )
+		{
+			m_vmin = std::stoi( settings.at( "vmin" ) );
+			if( m_vmin < 0 || m_vmin > 255 )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "vtime" ) )
+		{
+			m_vtime = std::stoi( settings.at( "vtime" ) );
+			if( m_vtime < 0 || m_vtime > 255 )
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "low_latency" ) )
+		{
+			m_low_latency = macrodevice::string_to_bool( settings.at( "low_latency" ), false );
+		}
+		
 	}
 	catch( std::exception &e )
 	{
@@ -45,13 +146,24 @@ int macrodevice::device_serial::load_settings( const std::map< std::string, std:
  */
 int macrodevice::device_serial::open_device()
 {
-	// open eventfile
-	m_filedesc = open( m_port_path.c_str(), O_RDONLY|O_NOCTTY|O_SYNC );
+	// open the serial port, reads never block, waiting happens with poll()
+	m_filedesc = open( m_port_path.c_str(), O_RDONLY|O_NOCTTY|O_NONBLOCK|O_CLOEXEC );
 	if( m_filedesc < 0 )
 	{
 		return MACRODEVICE_FAILURE;
 	}
 	
+	if( configure_port() != MACRODEVICE_SUCCESS )
+	{
+		restore_port();
+		close( m_filedesc );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_buffer.resize( MACRODEVICE_SERIAL_BUFFER_SIZE );
+	m_begin = m_end = m_scanned = 0;
+	m_discard = 0;
+	
 	// set up polling
 	m_pollfd[0].fd = m_filedesc;
 	m_pollfd[0].events = POLLIN;
@@ -59,11 +171,125 @@ int macrodevice::device_serial::open_device()
 	return MACRODEVICE_SUCCESS;
 }
 
+/**
+ * @copydoc macrodevice::device_serial::configure_port
+ */
+int macrodevice::device_serial::configure_port()
+{
+	// the latency timer of USB serial adapters (e.g. 16 ms with FTDI chips) only gets lowered by drivers that support it
+	if( m_low_latency )
+	{
+		struct serial_struct serial;
+		if( ioctl( m_filedesc, TIOCGSERIAL, &serial ) == 0 && !( serial.flags & ASYNC_LOW_LATENCY ) )
+		{
+			serial.flags |= ASYNC_LOW_LATENCY;
+			m_restore_flags = ioctl( m_filedesc, TIOCSSERIAL, &serial ) == 0;
+		}
+	}
+	
+	// keep the current line settings if none are specified
+	if( m_baud == 0 && m_data_bits == 0 && m_parity.empty() && m_stop_bits == 0 && !m_raw && m_vmin < 0 && m_vtime < 0 )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	struct termios options;
+	if( tcgetattr( m_filedesc, &options ) < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	m_original_termios = options;
+	
+	if( m_raw )
+	{
+		cfmakeraw( &options );
+	}
+	
+	// enable the receiver, ignore the modem control lines
+	options.c_cflag |= CREAD|CLOCAL;
+	
+	if( m_baud != 0 )
+	{
+		cfsetispeed( &options, m_baud );
+		cfsetospeed( &options, m_baud );
+	}
+	
+	if( m_data_bits != 0 )
+	{
+		const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+		options.c_cflag &= ~CSIZE;
+		options.c_cflag |= sizes[m_data_bits - 5];
+	}
+	
+	if( m_parity == "none" )
+	{
+		options.c_cflag &= ~( PARENB|PARODD );
+	}
+	else if( m_parity == "even" )
+	{
+		options.c_cflag |= PARENB;
+		options.c_cflag &= ~PARODD;
+	}
+	else if( m_parity == "odd" )
+	{
+		options.c_cflag |= PARENB|PARODD;
+	}
+	
+	if( m_stop_bits == 1 )
+	{
+		options.c_cflag &= ~CSTOPB;
+	}
+	else if( m_stop_bits == 2 )
+	{
+		options.c_cflag |= CSTOPB;
+	}
+	
+	// in non-canonical mode, VMIN = 0 and VTIME = 0 let read() return 0 instead of EAGAIN even with O_NONBLOCK,
+	// VMIN = 1 makes poll() wait for the first byte. A larger VMIN (with VTIME = 0) makes poll() wait for that many bytes.
+	options.c_cc[VMIN] = m_vmin >= 0 ? m_vmin : 1;
+	options.c_cc[VTIME] = m_vtime >= 0 ? m_vtime : 0;
+	
+	if( tcsetattr( m_filedesc, TCSANOW, &options ) < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	m_restore_termios = true;
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_serial::restore_port
+ */
+void macrodevice::device_serial::restore_port()
+{
+	if( m_restore_termios )
+	{
+		tcsetattr( m_filedesc, TCSANOW, &m_original_termios );
+		m_restore_termios = false;
+	}
+	
+	// the latency timer stays low after the port has been closed, until the flag is cleared
+	// the flag wasn't set before open_device, so clearing it restores the original flags
+	if( m_restore_flags )
+	{
+		struct serial_struct serial;
+		if( ioctl( m_filedesc, TIOCGSERIAL, &serial ) == 0 )
+		{
+			serial.flags &= ~ASYNC_LOW_LATENCY;
+			ioctl( m_filedesc, TIOCSSERIAL, &serial );
+		}
+		m_restore_flags = false;
+	}
+}
+
 /**
  * @copydoc macrodevice::device_serial::close_device
  */
 int macrodevice::device_serial::close_device()
 {	
+	restore_port();
+	
 	// close the serial port
 	close( m_filedesc );
 	
@@ -73,52 +299,282 @@ int macrodevice::device_serial::close_device()
 /**
  * @copydoc macrodevice::device_serial::wait_for_event
  */
-int macrodevice::device_serial::wait_for_event( std::vector< std::string > &event )
+int macrodevice::device_serial::wait_for_event( macrodevice::event &event )
 {
+	// messages left over from the last read
+	if( next_message( event ) )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
 	
-	std::string received_message = "";
-	char received_char[1];
-	int num_received = 0;
+	uint64_t deadline = m_timeout > 0 ? macrodevice::monotonic_ns() + m_timeout * 1000000ull : 0;
+	bool hangup = false;
 	
-	// wait for change in /dev/input/event* (no timeout)
-	num_received = read( m_filedesc, received_char, 1 ); 
-	if( num_received == 0 ) // read single byte
+	while( true )
 	{
-		// poll if no byte received
-		if( poll( m_pollfd, 1, -1 ) < 0 )
+		// get all available bytes
+		size_t received;
+		if( fill_buffer( received ) != MACRODEVICE_SUCCESS )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		
+		if( next_message( event ) )
+		{
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		// the port has been closed (e.g. the device was unplugged) and the remaining bytes have been read
+		if( hangup && received == 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		
+		// wait for more input on the serial port
+		int timeout = m_timeout;
+		if( m_timeout > 0 )
+		{
+			uint64_t now = macrodevice::monotonic_ns();
+			timeout = now < deadline ? ( deadline - now + 999999 ) / 1000000 : 0;
+		}
+		
+		int p = poll( m_pollfd, 1, timeout );
+		if( p < 0 )
 		{
 			return MACRODEVICE_FAILURE;
 		}
+		else if( p == 0 )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+		
+		hangup = m_pollfd[0].revents & ( POLLERR|POLLHUP );
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_serial::fill_buffer
+ */
+int macrodevice::device_serial::fill_buffer( size_t &received )
+{
+	received = 0;
+	
+	// move the incomplete message to the start of the buffer, the previous event isn't used anymore
+	if( m_begin == m_end )
+	{
+		m_begin = m_end = m_scanned = 0;
+	}
+	else if( m_end == m_buffer.size() && m_begin > 0 )
+	{
+		memmove( m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin );
+		m_end -= m_begin;
+		m_scanned -= m_begin;
+		m_begin = 0;
+	}
+	
+	if( m_end == m_buffer.size() )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	// 0 is returned without pending bytes in non-canonical mode with VMIN = 0, or after a hangup, which is detected by poll()
+	ssize_t size = read( m_filedesc, m_buffer.data() + m_end, m_buffer.size() - m_end );
+	if( size < 0 )
+	{
+		return ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ? MACRODEVICE_SUCCESS : MACRODEVICE_FAILURE;
+	}
+	else if( size == 0 )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
+	
+	received = size;
+	m_end += size;
+	m_read_time = macrodevice::monotonic_ns();
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_serial::next_message
+ */
+bool macrodevice::device_serial::next_message( macrodevice::event &event )
+{
+	char *start;
+	size_t size;
+	
+	// invalid messages are skipped
+	while( true )
+	{
+		if( m_framing == framing::length )
+		{
+			if( !next_length_frame( start, size ) )
+				return false;
+		}
+		else
+		{
+			if( !next_delimited_frame( start, size ) )
+				return false;
+		}
+		
+		if( m_framing == framing::cobs )
+		{
+			// zero bytes without a message in between are allowed, e.g. to synchronize
+			if( size == 0 || !cobs_decode( start, size ) )
+				continue;
+		}
+		else if( m_framing == framing::delimiter && m_strip_cr && size > 0 && start[size-1] == '\r' )
+		{
+			size--;
+		}
+		
+		event.clear();
+		event.timestamp = m_read_time;
+		
+		if( m_unpack.empty() )
+		{
+			event.payload = start;
+			event.payload_size = size;
+			return true;
+		}
+		
+		// unpack the fields of a binary message
+		size_t offset = 0;
+		for( auto &f : m_unpack )
+		{
+			if( offset + f.size > size )
+				break;
+			
+			uint64_t value = 0;
+			for( unsigned int i = 0; i < f.size; i++ )
+				value |= (uint64_t)(uint8_t)start[offset + i] << ( 8 * i );
+			
+			// sign extension
+			if( f.is_signed && f.size < 8 && ( value & ( 1ull << ( 8 * f.size - 1 ) ) ) )
+				value |= ~0ull << ( 8 * f.size );
+			
+			event.push( (long long)value );
+			offset += f.size;
+		}
+		
+		if( event.size == m_unpack.size() )
+			return true;
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_serial::next_delimited_frame
+ */
+bool macrodevice::device_serial::next_delimited_frame( char *&start, size_t &size )
+{
+	char delimiter_char = m_framing == framing::cobs ? '\0' : m_delimiter;
+	
+	start = m_buffer.data() + m_begin;
+	char *delimiter = static_cast< char* >( memchr( m_buffer.data() + m_scanned, delimiter_char, m_end - m_scanned ) );
+	
+	if( delimiter )
+	{
+		size = delimiter - start;
+		m_begin += size + 1;
 	}
-	else if( num_received == 1 ) // single byte received
+	else if( m_end - m_begin == m_buffer.size() )
 	{
-		received_message.push_back( received_char[0] );
+		// the message doesn't fit into the buffer, pass on the received part
+		size = m_end - m_begin;
+		m_begin = m_end;
 	}
 	else
 	{
-		return MACRODEVICE_FAILURE; // read failure
+		m_scanned = m_end;
+		return false;
 	}
 	
-	event.clear();
+	m_scanned = m_begin;
 	
-	// get whole message
-	while( ( num_received = read( m_filedesc, received_char, 1 ) ) == 1 ) // while receiving bytes
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::device_serial::next_length_frame
+ */
+bool macrodevice::device_serial::next_length_frame( char *&start, size_t &size )
+{
+	while( true )
 	{
-		if( received_char[0] == '\n' ) // break if newline is received
+		// the rest of a message that is too long
+		if( m_discard > 0 )
+		{
+			size_t discarded = std::min( m_discard, m_end - m_begin );
+			m_begin += discarded;
+			m_discard -= discarded;
+			m_scanned = m_begin;
+			
+			if( m_discard > 0 )
+				return false;
+		}
+		
+		if( m_end - m_begin < m_length_size )
+			return false;
+		
+		size_t length = 0;
+		for( unsigned int i = 0; i < m_length_size; i++ )
+			length |= (size_t)(uint8_t)m_buffer[m_begin + i] << ( 8 * i );
+		
+		// drop a message that doesn't fit into the buffer as a whole, the next prefix follows it,
+		// skipping single bytes instead would read the data of the message as lengths
+		if( m_length_size + length > m_buffer.size() )
 		{
-			break;
+			m_begin += m_length_size;
+			m_discard = length;
+			continue;
 		}
 		
-		received_message.push_back( received_char[0] );
+		if( m_end - m_begin < m_length_size + length )
+			return false;
+		
+		start = m_buffer.data() + m_begin + m_length_size;
+		size = length;
+		m_begin += m_length_size + length;
+		m_scanned = m_begin;
+		
+		return true;
 	}
+}
+
+/**
+ * @copydoc macrodevice::device_serial::cobs_decode
+ */
+bool macrodevice::device_serial::cobs_decode( char *data, size_t &size )
+{
+	size_t in = 0, out = 0;
 	
-	// if read failure
-	if( num_received < 0 )
+	while( in < size )
 	{
-		return MACRODEVICE_FAILURE;
+		// each block starts with the offset to the next zero byte
+		uint8_t code = data[in++];
+		if( code == 0 || in + code - 1 > size )
+			return false;
+		
+		memmove( data + out, data + in, code - 1 );
+		in += code - 1;
+		out += code - 1;
+		
+		// blocks of the maximum length are not followed by a zero byte, neither is the last block
+		if( code < 0xff && in < size )
+			data[out++] = 0;
 	}
 	
-	event.push_back( received_message );
+	size = out;
+	
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::device_serial::get_pollfds
+ */
+int macrodevice::device_serial::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	fds.push_back( { m_filedesc, POLLIN, 0 } );
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -26,15 +26,23 @@
 #include <map>
 #include <string>
 #include <exception>
+#include <cstring>
+#include <cerrno>
 
 #include <sys/types.h> // for open()
 #include <sys/stat.h> // for open()
 #include <fcntl.h> // for open()
 #include <poll.h>
 #include <unistd.h> // for read()
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h> // for ASYNC_LOW_LATENCY
 
 #include "helpers.h"
 
+/// Size of the receive buffer in bytes, longer messages get split
+#define MACRODEVICE_SERIAL_BUFFER_SIZE 65536
+
 namespace macrodevice
 {
 	class device_serial;
@@ -56,11 +64,127 @@ class macrodevice::device_serial
 		
 		struct pollfd m_pollfd[1];
 		
+		/// poll timeout
+		int m_timeout = -1;
+		
+		/// the character at the end of each message
+		char m_delimiter = '\n';
+		
+		/// remove a '\r' at the end of each message?
+		bool m_strip_cr = true;
+		
+		/// how messages are separated
+		enum class framing
+		{
+			delimiter, ///< text messages ending with m_delimiter
+			cobs, ///< binary messages encoded with COBS, ending with a zero byte
+			length ///< binary messages preceded by their length
+		};
+		framing m_framing = framing::delimiter;
+		
+		/// size of the length prefix in bytes (little endian) with framing::length
+		unsigned int m_length_size = 1;
+		
+		/// the number of bytes of a message that is too long for the buffer, which still have to be dropped
+		size_t m_discard = 0;
+		
+		/// a field unpacked from binary messages
+		struct field_format
+		{
+			unsigned int size; ///< in bytes, little endian
+			bool is_signed;
+		};
+		
+		/// the fields of binary messages, empty to pass messages as payload
+		std::vector< field_format > m_unpack;
+		
+		/// line settings, 0 or empty to keep the current setting of the port
+		speed_t m_baud = 0;
+		int m_data_bits = 0;
+		std::string m_parity;
+		int m_stop_bits = 0;
+		
+		/// disable all processing of the received bytes by the terminal driver (cfmakeraw)?
+		bool m_raw = false;
+		
+		/// VMIN and VTIME for non-canonical mode, -1 to use 1 and 0 when the line settings are changed
+		int m_vmin = -1, m_vtime = -1;
+		
+		/// request ASYNC_LOW_LATENCY from the driver?
+		bool m_low_latency = false;
+		
+		/// the settings of the port before open_device, restored by close_device
+		struct termios m_original_termios;
+		bool m_restore_termios = false;
+		
+		/// has open_device set ASYNC_LOW_LATENCY? It is cleared again by close_device
+		bool m_restore_flags = false;
+		
+		/**
+		 * Applies the line settings to the opened port
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int configure_port();
+		
+		/**
+		 * Restores the line settings and driver flags changed by configure_port, for other programs
+		 */
+		void restore_port();
+		
+		/// received bytes, the events point into this buffer
+		std::vector< char > m_buffer;
+		
+		/// the received bytes that haven't been passed on are m_buffer[m_begin] to m_buffer[m_end-1]
+		size_t m_begin = 0, m_end = 0;
+		
+		/// the bytes up to this position don't contain the delimiter
+		size_t m_scanned = 0;
+		
+		/// time of the last read()
+		uint64_t m_read_time = 0;
+		
+		/**
+		 * Reads the available bytes into the buffer without blocking
+		 * @param received The number of bytes that have been read, 0 doesn't mean that the port has been closed
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int fill_buffer( size_t &received );
+		
+		/**
+		 * Takes the next complete message from the buffer
+		 * @param event The message is passed as payload, or as unpacked fields
+		 * @return false if the buffer doesn't contain a complete message
+		 */
+		bool next_message( macrodevice::event &event );
+		
+		/**
+		 * Takes the bytes up to the next delimiter from the buffer
+		 * @return false if the buffer doesn't contain the delimiter
+		 */
+		bool next_delimited_frame( char *&start, size_t &size );
+		
+		/**
+		 * Takes the next message with a length prefix from the buffer
+		 * @return false if the buffer doesn't contain a complete message
+		 */
+		bool next_length_frame( char *&start, size_t &size );
+		
+		/**
+		 * Decodes a COBS encoded message in place, without the terminating zero byte
+		 * @param size The size of the message, gets set to the decoded size
+		 * @return false if the message is invalid
+		 */
+		static bool cobs_decode( char *data, size_t &size );
+		
 	public:
 		
+		/// the events of this backend consist of a payload (unless unpack is set)
+		static constexpr bool payload_events = true;
+		
 		/**
 		 * Loads the device settings, e.g. serial port
-		 * Valid settings keys are: port
+		 * Valid settings keys are: port, timeout, delimiter, strip_cr, framing, length_size, unpack,
+		 * baud, data_bits, parity, stop_bits, raw, vmin, vtime, low_latency
 		 * @param settings A map of settings keys to their values
 		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if required settings are missing or invalid
 		 */
@@ -82,10 +206,17 @@ class macrodevice::device_serial
 		
 		/**
 		 * Waits for an event, i.e. keypress to occur
-		 * @param event The received event, typically of size == 1
-		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * @param event The received event, the message is passed as payload or as unpacked fields
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
 		 */
-		int wait_for_event( std::vector< std::string > &event );
+		int get_pollfds( std::vector< struct pollfd > &fds );
 		
 };
 
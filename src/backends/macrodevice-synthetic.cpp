@@ -0,0 +1,254 @@
+/*
+ * macrodevice-synthetic.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "macrodevice-synthetic.h"
+
+/**
+ * @copydoc macrodevice::device_synthetic::load_settings
+ */
+int macrodevice::device_synthetic::load_settings( const std::map< std::string, std::string > &settings )
+{
+	
+	// read settings
+	try
+	{
+		if( settings.contains( "shape" ) )
+		{
+			if( settings.at( "shape" ) == "libevdev" )
+				m_shape = event_shape::libevdev;
+			else if( settings.at( "shape" ) == "libusb" )
+				m_shape = event_shape::libusb;
+			else if( settings.at( "shape" ) == "serial" )
+				m_shape = event_shape::serial;
+			else
+				return MACRODEVICE_FAILURE;
+		}
+		if( settings.contains( "rate" ) )
+		{
+			m_rate = std::stod( settings.at( "rate" ) );
+		}
+		if( settings.contains( "burst" ) )
+		{
+			m_burst = std::stoi( settings.at( "burst" ) );
+		}
+		if( settings.contains( "count" ) )
+		{
+			m_count = std::stoull( settings.at( "count" ) );
+		}
+		if( settings.contains( "numbers" ) )
+		{
+			m_numbers = macrodevice::string_to_bool( settings.at( "numbers" ), true );
+		}
+		if( settings.contains( "timeout" ) )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
+		
+	}
+	catch( std::exception &e )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	if( m_rate <= 0 || m_burst < 1 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::open_device
+ */
+int macrodevice::device_synthetic::open_device()
+{
+	m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+	if( m_timerfd < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// expire once per burst
+	m_interval = m_burst * 1e9 / m_rate;
+	if( m_interval < 1 )
+	{
+		m_interval = 1;
+	}
+	
+	struct itimerspec timer;
+	timer.it_interval.tv_sec = m_interval / 1000000000;
+	timer.it_interval.tv_nsec = m_interval % 1000000000;
+	timer.it_value = timer.it_interval;
+	
+	m_wake = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+	if( m_wake < 0 )
+	{
+		close( m_timerfd );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_start = macrodevice::monotonic_ns();
+	if( timerfd_settime( m_timerfd, 0, &timer, NULL ) < 0 )
+	{
+		close_device();
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// set up polling
+	m_pollfd[0].fd = m_timerfd;
+	m_pollfd[0].events = POLLIN;
+	m_pollfd[1].fd = m_wake;
+	m_pollfd[1].events = POLLIN;
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::close_device
+ */
+int macrodevice::device_synthetic::close_device()
+{
+	close( m_timerfd );
+	close( m_wake );
+	m_timerfd = m_wake = -1;
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::wait_for_event
+ */
+int macrodevice::device_synthetic::wait_for_event( macrodevice::event &event )
+{
+	// wait for the next burst, after the last event (the timer is disarmed) only until the device gets closed
+	while( m_available == 0 || ( m_count > 0 && m_generated >= m_count ) )
+	{
+		int p = poll( m_pollfd, 2, m_timeout );
+		if( p < 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		else if( p == 0 )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+		else if( m_pollfd[1].revents & POLLIN )
+		{
+			uint64_t value;
+			if( read( m_wake, &value, sizeof( value ) ) < 0 )
+			{
+				// already reset
+			}
+			return MACRODEVICE_TIMEOUT;
+		}
+		
+		uint64_t expirations;
+		if( read( m_timerfd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) )
+		{
+			m_available += expirations * m_burst;
+		}
+		else if( m_timeout == 0 )
+		{
+			return MACRODEVICE_TIMEOUT;
+		}
+	}
+	
+	generate( event );
+	
+	m_available--;
+	m_generated++;
+	
+	// stop the timer after the last event, so that the reactor doesn't wake up anymore
+	if( m_count > 0 && m_generated >= m_count )
+	{
+		struct itimerspec disarm = {};
+		timerfd_settime( m_timerfd, 0, &disarm, NULL );
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::generate
+ */
+void macrodevice::device_synthetic::generate( macrodevice::event &event )
+{
+	event.clear();
+	
+	// the time the burst of the event was due, so that a backlog shows up as latency
+	event.timestamp = m_start + ( m_generated / m_burst + 1 ) * m_interval;
+	
+	if( m_shape == event_shape::libevdev )
+	{
+		// press, SYN_REPORT, release, SYN_REPORT
+		unsigned int step = m_generated % 4;
+		
+		if( step % 2 == 0 )
+		{
+			event.push( 1, m_numbers ? NULL : "EV_KEY" );
+			event.push( 30, m_numbers ? NULL : "KEY_A" );
+			event.push( step == 0 ? 1 : 0 );
+		}
+		else
+		{
+			event.push( 0, m_numbers ? NULL : "EV_SYN" );
+			event.push( 0, m_numbers ? NULL : "SYN_REPORT" );
+			event.push( 0 );
+		}
+	}
+	else if( m_shape == event_shape::libusb )
+	{
+		// key a, every other event with left shift
+		event.push( m_generated % 2 == 0 ? 0 : 2 );
+		event.push( 4 );
+	}
+	else
+	{
+		int length = snprintf( m_message, sizeof( m_message ), "message %llu", (unsigned long long)m_generated );
+		event.payload = m_message;
+		event.payload_size = length;
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::get_pollfds
+ */
+int macrodevice::device_synthetic::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	fds.push_back( { m_timerfd, POLLIN, 0 } );
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::device_synthetic::interrupt
+ */
+void macrodevice::device_synthetic::interrupt()
+{
+	if( m_wake >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wake, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, wait_for_event gets woken up anyway
+		}
+	}
+}
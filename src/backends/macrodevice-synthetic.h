@@ -0,0 +1,152 @@
+/*
+ * macrodevice-synthetic.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_SYNTHETIC
+#define MACRODEVICE_SYNTHETIC
+
+#include <vector>
+#include <map>
+#include <string>
+#include <exception>
+#include <cstdint>
+#include <cstdio>
+
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h> // for read()
+
+#include "helpers.h"
+
+namespace macrodevice
+{
+	class device_synthetic;
+}
+
+/**
+ * The class for the synthetic backend, generates events at a fixed rate, used for benchmarks
+ */
+class macrodevice::device_synthetic
+{
+	
+	private:
+		
+		/// The backend whose events are imitated
+		enum class event_shape
+		{
+			libevdev, ///< EV_KEY press and release events, each followed by a SYN_REPORT
+			libusb, ///< modifier and key
+			serial ///< a message as payload
+		};
+		
+		event_shape m_shape = event_shape::libevdev;
+		
+		/// events per second
+		double m_rate = 1000;
+		
+		/// number of events generated at once
+		unsigned int m_burst = 1;
+		
+		/// number of events after which no more events are generated, 0 for no limit
+		uint64_t m_count = 0;
+		
+		/// return event codes as numbers instead of names? (libevdev shape)
+		bool m_numbers = false;
+		
+		/// poll timeout
+		int m_timeout = -1;
+		
+		/// expires once per burst
+		int m_timerfd = -1;
+		
+		/// eventfd to wake up poll(), see interrupt()
+		int m_wake = -1;
+		
+		struct pollfd m_pollfd[2];
+		
+		/// time between bursts in ns
+		uint64_t m_interval = 0;
+		
+		/// time when the device has been opened
+		uint64_t m_start = 0;
+		
+		/// number of events that are due but haven't been returned yet
+		uint64_t m_available = 0;
+		
+		/// number of returned events
+		uint64_t m_generated = 0;
+		
+		/// the message of the serial shape, the event points into this buffer
+		char m_message[32];
+		
+		/**
+		 * Sets the fields of the next event
+		 * @param event The event
+		 */
+		void generate( macrodevice::event &event );
+		
+	public:
+		
+		/**
+		 * Loads the device settings, e.g. rate
+		 * Valid settings keys are: shape, rate, burst, count, numbers, timeout
+		 * @param settings A map of settings keys to their values
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int load_settings( const std::map< std::string, std::string > &settings );
+		
+		/**
+		 * Starts generating events
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 * @see load_settings
+		 */
+		int open_device();
+		
+		/**
+		 * Stops generating events
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 * @see open_device
+		 */
+		int close_device();
+		
+		/**
+		 * Waits for the next event to be due
+		 * @param event The generated event, its timestamp is the time it was due
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int get_pollfds( std::vector< struct pollfd > &fds );
+		
+		/**
+		 * Wakes up wait_for_event, which returns MACRODEVICE_TIMEOUT, can be called from any thread
+		 * Without it, a device that has generated count events could only be closed after the timeout
+		 */
+		void interrupt();
+		
+};
+
+#endif
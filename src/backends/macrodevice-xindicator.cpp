@@ -26,10 +26,22 @@
 int macrodevice::device_xindicator::load_settings( const std::map< std::string, std::string > &settings )
 {
 	
-	// read settings, this backend has no settings (at the moment)
-	
-	// this prevents an unused parameter compiler warning
-	(void)settings;
+	// read settings
+	try
+	{
+		if( settings.contains( "timeout" ) )
+		{
+			m_timeout = std::stoi( settings.at( "timeout" ) );
+		}
+		if( settings.contains( "changes" ) )
+		{
+			m_changes = macrodevice::string_to_bool( settings.at( "changes" ), false );
+		}
+	}
+	catch( std::exception &e )
+	{
+		return MACRODEVICE_FAILURE;
+	}
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -46,9 +58,31 @@ int macrodevice::device_xindicator::open_device()
 	if( m_display == NULL )
 		return MACRODEVICE_FAILURE;
 	
+	// the XKB extension is needed to identify its events
+	int opcode, error_base, major = XkbMajorVersion, minor = XkbMinorVersion;
+	if( XkbQueryExtension( m_display, &opcode, &m_xkb_event_base, &error_base, &major, &minor ) != True )
+	{
+		XCloseDisplay( m_display );
+		return MACRODEVICE_FAILURE;
+	}
+	
 	// select to receive indicator state events
 	if( XkbSelectEvents( m_display, XkbUseCoreKbd, XkbIndicatorStateNotifyMask, XkbIndicatorStateNotifyMask ) != True )
+	{
+		XCloseDisplay( m_display );
+		return MACRODEVICE_FAILURE;
+	}
+	
+	m_wake = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+	if( m_wake < 0 )
+	{
+		XCloseDisplay( m_display );
 		return MACRODEVICE_FAILURE;
+	}
+	
+	if( m_changes )
+		load_names();
+	m_changed = 0;
 	
 	return MACRODEVICE_SUCCESS;
 }
@@ -62,42 +96,179 @@ int macrodevice::device_xindicator::close_device()
 	// close X Display
 	XCloseDisplay( m_display );
 	
+	close( m_wake );
+	m_wake = -1;
+	
 	return MACRODEVICE_SUCCESS;
 }
 
 /**
  * @copydoc macrodevice::device_xindicator::wait_for_event
  */
-int macrodevice::device_xindicator::wait_for_event( std::vector< std::string > &event )
+int macrodevice::device_xindicator::wait_for_event( macrodevice::event &event )
 {
+	// the remaining changes of the last event
+	if( next_change( event ) )
+	{
+		return MACRODEVICE_SUCCESS;
+	}
 	
 	while( 1 )
 	{
-		// get next event (this blocks)
-		XEvent xevent;
-		XNextEvent( m_display, &xevent );
-		
-		// indicator state event received
-		if( xevent.type & XkbIndicatorStateNotify )
+		// wait for the X server if no events are queued
+		if( XPending( m_display ) == 0 )
 		{
+			struct pollfd x_pollfd[2];
+			x_pollfd[0].fd = ConnectionNumber( m_display );
+			x_pollfd[0].events = POLLIN;
+			x_pollfd[1].fd = m_wake;
+			x_pollfd[1].events = POLLIN;
 			
-			// get indicator state
-			// Maybe there is a way to get the state from the event, that would be more elegant
-			unsigned int state;
-			if( XkbGetIndicatorState( m_display, XkbUseCoreKbd, &state ) == Success )
+			int p = poll( x_pollfd, 2, m_timeout );
+			if( p < 0 )
 			{
-				event.push_back( std::to_string(state) );
-				break;
+				return MACRODEVICE_FAILURE;
 			}
-			else
+			else if( p == 0 )
 			{
-				// could not get indicator state
-				return MACRODEVICE_FAILURE;
+				return MACRODEVICE_TIMEOUT;
+			}
+			else if( x_pollfd[1].revents & POLLIN )
+			{
+				uint64_t value;
+				if( read( m_wake, &value, sizeof( value ) ) < 0 )
+				{
+					// already reset
+				}
+				return MACRODEVICE_TIMEOUT;
 			}
 			
+			// the received data doesn't have to be a complete event
+			if( XPending( m_display ) == 0 )
+			{
+				continue;
+			}
+		}
+		
+		// get next event (doesn't block, as an event is queued)
+		XkbEvent xevent;
+		XNextEvent( m_display, &xevent.core );
+		
+		// indicator state event received, it contains the state of all indicators
+		if( xevent.type == m_xkb_event_base && xevent.any.xkb_type == XkbIndicatorStateNotify )
+		{
+			uint64_t timestamp = macrodevice::monotonic_ns();
+			
+			if( m_changes )
+			{
+				m_changed = xevent.indicators.changed;
+				m_state = xevent.indicators.state;
+				m_timestamp = timestamp;
+				
+				if( next_change( event ) )
+					return MACRODEVICE_SUCCESS;
+				
+				continue;
+			}
+			
+			event.clear();
+			event.timestamp = timestamp;
+			event.push( xevent.indicators.state );
+			
+			return MACRODEVICE_SUCCESS;
 		}
 		
 	}
+}
+
+/**
+ * @copydoc macrodevice::device_xindicator::next_change
+ */
+bool macrodevice::device_xindicator::next_change( macrodevice::event &event )
+{
+	if( m_changed == 0 )
+		return false;
+	
+	// the lowest changed indicator
+	unsigned int index = std::countr_zero( m_changed );
+	m_changed &= m_changed - 1;
+	
+	event.clear();
+	event.timestamp = m_timestamp;
+	event.push( index, m_names[index] );
+	event.push( ( m_state >> index ) & 1 );
+	event.push( m_state );
+	
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::device_xindicator::load_names
+ */
+void macrodevice::device_xindicator::load_names()
+{
+	for( const char *&name : m_names )
+		name = NULL;
+	
+	XkbDescPtr xkb = XkbAllocKeyboard();
+	if( xkb == NULL )
+		return;
+	
+	// indicators without names are passed without a name
+	if( XkbGetNames( m_display, XkbIndicatorNamesMask, xkb ) == Success && xkb->names != NULL )
+	{
+		for( unsigned int i = 0; i < XkbNumIndicators; i++ )
+		{
+			if( xkb->names->indicators[i] == None )
+				continue;
+			
+			char *name = XGetAtomName( m_display, xkb->names->indicators[i] );
+			if( name != NULL )
+			{
+				m_names[i] = intern_name( name );
+				XFree( name );
+			}
+		}
+	}
+	
+	XkbFreeKeyboard( xkb, 0, True );
+}
+
+/**
+ * @copydoc macrodevice::device_xindicator::get_pollfds
+ */
+int macrodevice::device_xindicator::get_pollfds( std::vector< struct pollfd > &fds )
+{
+	// events are received over the connection to the X server
+	fds.push_back( { ConnectionNumber( m_display ), POLLIN, 0 } );
 	
 	return MACRODEVICE_SUCCESS;
 }
+
+/**
+ * @copydoc macrodevice::device_xindicator::interrupt
+ */
+void macrodevice::device_xindicator::interrupt()
+{
+	if( m_wake >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wake, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, wait_for_event gets woken up anyway
+		}
+	}
+}
+
+/**
+ * @copydoc macrodevice::device_xindicator::intern_name
+ */
+const char *macrodevice::device_xindicator::intern_name( const char *name )
+{
+	// shared by all devices, the elements of a std::set don't move
+	static std::mutex mutex;
+	static std::set< std::string > names;
+	
+	const std::lock_guard<std::mutex> lock( mutex );
+	return names.insert( name ).first->c_str();
+}
@@ -26,6 +26,13 @@
 #include <map>
 #include <string>
 #include <exception>
+#include <bit>
+#include <set>
+#include <mutex>
+
+#include <poll.h>
+#include <unistd.h> // for read()
+#include <sys/eventfd.h>
 
 #include <X11/XKBlib.h> // Xlib
 
@@ -37,7 +44,7 @@ namespace macrodevice
 }
 
 /**
- * The class for the serial backend
+ * The class for the xindicator backend
  */
 class macrodevice::device_xindicator
 {
@@ -47,11 +54,51 @@ class macrodevice::device_xindicator
 		/// X Display
 		Display *m_display;
 		
+		/// eventfd to wake up poll(), see interrupt()
+		int m_wake = -1;
+		
+		/// poll timeout
+		int m_timeout = -1;
+		
+		/// event type of the XKB events
+		int m_xkb_event_base = 0;
+		
+		/// pass an event for each changed indicator instead of the state of all indicators?
+		bool m_changes = false;
+		
+		/// the names of the indicators, NULL if an indicator has no name, see intern_name()
+		const char *m_names[XkbNumIndicators] = {};
+		
+		/// the changed indicators of the last XkbIndicatorStateNotify event that haven't been passed on, with changes = true
+		unsigned int m_changed = 0;
+		unsigned int m_state = 0;
+		uint64_t m_timestamp = 0;
+		
+		/**
+		 * Gets the names of the indicators from the X server
+		 */
+		void load_names();
+		
+		/**
+		 * Stores a name until the process exits, as the names of event fields point to static storage
+		 * Each distinct name is stored once, so reopening the device doesn't use more memory
+		 * @param name The name
+		 * @return The stored copy of the name
+		 */
+		static const char *intern_name( const char *name );
+		
+		/**
+		 * Takes the next changed indicator of the last XkbIndicatorStateNotify event
+		 * @param event The change
+		 * @return false if all changes have been taken
+		 */
+		bool next_change( macrodevice::event &event );
+		
 	public:
 		
 		/**
-		 * Loads the device settings, e.g. serial port
-		 * Valid settings keys are: port
+		 * Loads the device settings, e.g. timeout
+		 * Valid settings keys are: timeout, changes
 		 * @param settings A map of settings keys to their values
 		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if required settings are missing or invalid
 		 */
@@ -72,11 +119,23 @@ class macrodevice::device_xindicator
 		int close_device();
 		
 		/**
-		 * Waits for an event, i.e. keypress to occur
-		 * @param event The received event, typically of size == 1
-		 * @return MACRODEVICE_SUCCESS if successful, MACRODEVICE_FAILURE if unsuccessful
+		 * Waits for an event, i.e. a change of the keyboard indicators
+		 * @param event The received event: the state of all indicators, or index, state and all indicators with changes = true
+		 * @return MACRODEVICE_SUCCESS, MACRODEVICE_FAILURE or MACRODEVICE_TIMEOUT
+		 */
+		int wait_for_event( macrodevice::event &event );
+		
+		/**
+		 * Gets the file descriptors that become ready when an event is available, used by the reactor
+		 * @param fds The file descriptors and their events (POLLIN) get appended to this vector
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int get_pollfds( std::vector< struct pollfd > &fds );
+		
+		/**
+		 * Wakes up wait_for_event, which returns MACRODEVICE_TIMEOUT, can be called from any thread
 		 */
-		int wait_for_event( std::vector< std::string > &event );
+		void interrupt();
 		
 };
 
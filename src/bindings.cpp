@@ -0,0 +1,135 @@
+/*
+ * bindings.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "bindings.h"
+
+bool macrodevice::bindings::key::operator==( const key &other ) const
+{
+	if( size != other.size )
+		return false;
+	
+	for( unsigned int i = 0; i < size; i++ )
+	{
+		if( value[i] != other.value[i] )
+			return false;
+	}
+	
+	return true;
+}
+
+size_t macrodevice::bindings::key_hash::operator()( const key &k ) const
+{
+	// FNV-1a over the values
+	uint64_t hash = 14695981039346656037ull;
+	for( unsigned int i = 0; i < k.size; i++ )
+	{
+		hash ^= (uint64_t)k.value[i];
+		hash *= 1099511628211ull;
+	}
+	
+	return hash ^ k.size;
+}
+
+/**
+ * @copydoc macrodevice::bindings::add
+ */
+bool macrodevice::bindings::add( const macrodevice::event &pattern, const binding &action, binding &replaced )
+{
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	bool found;
+	if( pattern.payload )
+	{
+		auto [ it, inserted ] = m_payloads.try_emplace( std::string( pattern.payload, pattern.payload_size ), action );
+		found = !inserted;
+		if( found )
+		{
+			replaced = std::move( it->second );
+			it->second = action;
+		}
+	}
+	else
+	{
+		key k;
+		k.size = pattern.size;
+		for( unsigned int i = 0; i < pattern.size; i++ )
+			k.value[i] = pattern.value[i];
+		
+		auto [ it, inserted ] = m_fields.try_emplace( k, action );
+		found = !inserted;
+		if( found )
+		{
+			replaced = std::move( it->second );
+			it->second = action;
+		}
+		m_sizes |= 1u << pattern.size;
+	}
+	
+	m_count = m_fields.size() + m_payloads.size();
+	
+	return found;
+}
+
+/**
+ * @copydoc macrodevice::bindings::find
+ */
+bool macrodevice::bindings::find( const macrodevice::event &event, binding &action )
+{
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	if( event.payload )
+	{
+		auto it = m_payloads.find( std::string_view( event.payload, event.payload_size ) );
+		if( it == m_payloads.end() )
+			return false;
+		
+		action = it->second;
+		return true;
+	}
+	
+	key k;
+	k.size = event.size;
+	for( unsigned int i = 0; i < event.size; i++ )
+		k.value[i] = event.value[i];
+	
+	// try the longest pattern first, skip sizes without patterns
+	for( ; k.size > 0; k.size-- )
+	{
+		if( !( m_sizes & ( 1u << k.size ) ) )
+			continue;
+		
+		auto it = m_fields.find( k );
+		if( it != m_fields.end() )
+		{
+			action = it->second;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/**
+ * @copydoc macrodevice::bindings::empty
+ */
+bool macrodevice::bindings::empty() const
+{
+	return m_count == 0;
+}
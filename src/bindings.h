@@ -0,0 +1,121 @@
+/*
+ * bindings.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_BINDINGS
+#define MACRODEVICE_BINDINGS
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "backends/helpers.h"
+
+namespace macrodevice
+{
+	/**
+	 * What happens when an event matches a binding
+	 */
+	struct binding
+	{
+		/// registry reference of a Lua function, used if command is empty
+		int function;
+		
+		/// a shell command
+		std::string command;
+	};
+	
+	class bindings;
+}
+
+/**
+ * A hash index of the bindings of a device, used to find the action of an event without calling Lua.
+ * A pattern matches all events that start with the fields of the pattern, the longest matching pattern wins.
+ * Events with a payload match patterns with the same payload.
+ * All member functions are thread safe.
+ */
+class macrodevice::bindings
+{
+	
+	private:
+		
+		/// The numeric fields of a pattern
+		struct key
+		{
+			unsigned int size;
+			long long value[MACRODEVICE_EVENT_SIZE];
+			
+			bool operator==( const key &other ) const;
+		};
+		
+		struct key_hash
+		{
+			size_t operator()( const key &k ) const;
+		};
+		
+		/// allows looking up payloads without creating a std::string
+		struct payload_hash
+		{
+			using is_transparent = void;
+			size_t operator()( std::string_view payload ) const { return std::hash< std::string_view >{}( payload ); }
+		};
+		
+		std::unordered_map< key, binding, key_hash > m_fields;
+		std::unordered_map< std::string, binding, payload_hash, std::equal_to<> > m_payloads;
+		
+		/// bit n is set if there is a pattern with n fields
+		unsigned int m_sizes = 0;
+		
+		/// number of bindings, read without locking the mutex
+		std::atomic< size_t > m_count = 0;
+		
+		std::mutex m_mutex;
+		
+	public:
+		
+		/**
+		 * Adds a binding, replaces an existing binding with the same pattern
+		 * @param pattern The fields (or the payload) to match
+		 * @param action The action
+		 * @param replaced The binding that has been replaced, so that its function can be released
+		 * @return true if an existing binding has been replaced
+		 */
+		bool add( const macrodevice::event &pattern, const binding &action, binding &replaced );
+		
+		/**
+		 * Finds the binding that matches an event
+		 * @param event The event
+		 * @param action The action of the binding
+		 * @return true if a binding has been found
+		 */
+		bool find( const macrodevice::event &event, binding &action );
+		
+		/**
+		 * Returns true if there are no bindings, doesn't lock the mutex
+		 */
+		bool empty() const;
+		
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * channels.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "channels.h"
+
+/**
+ * @copydoc macrodevice::channels::send
+ */
+void macrodevice::channels::send( const std::string &channel, const std::string &message )
+{
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		
+		auto &queue = m_channels[channel];
+		
+		// drop the oldest message if nobody is receiving
+		if( queue.size() >= MACRODEVICE_CHANNEL_SIZE )
+		{
+			queue.pop_front();
+		}
+		
+		queue.push_back( message );
+	}
+	
+	m_sent.notify_all();
+}
+
+/**
+ * @copydoc macrodevice::channels::receive
+ */
+int macrodevice::channels::receive( const std::string &channel, std::string &message, int timeout )
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	
+	auto has_message = [&](){ return m_channels.contains( channel ) && !m_channels.at( channel ).empty(); };
+	
+	// wait for a message
+	if( timeout < 0 )
+	{
+		m_sent.wait( lock, has_message );
+	}
+	else if( !m_sent.wait_for( lock, std::chrono::milliseconds( timeout ), has_message ) )
+	{
+		return MACRODEVICE_TIMEOUT;
+	}
+	
+	auto &queue = m_channels.at( channel );
+	message = std::move( queue.front() );
+	queue.pop_front();
+	
+	return MACRODEVICE_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*
+ * channels.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_CHANNELS
+#define MACRODEVICE_CHANNELS
+
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "backends/helpers.h"
+
+/// Maximum number of messages in a channel, the oldest message gets dropped when a channel is full
+#define MACRODEVICE_CHANNEL_SIZE 1024
+
+namespace macrodevice
+{
+	class channels;
+}
+
+/**
+ * Named message queues, used to communicate between Lua states.
+ * All member functions are thread safe.
+ */
+class macrodevice::channels
+{
+	
+	private:
+		
+		/// channel name -> queued messages
+		std::map< std::string, std::deque< std::string > > m_channels;
+		
+		std::mutex m_mutex;
+		
+		/// notified when a message is sent
+		std::condition_variable m_sent;
+		
+	public:
+		
+		/**
+		 * Appends a message to a channel
+		 * @param channel The name of the channel
+		 * @param message The message
+		 */
+		void send( const std::string &channel, const std::string &message );
+		
+		/**
+		 * Removes the oldest message from a channel
+		 * @param channel The name of the channel
+		 * @param message The received message
+		 * @param timeout Time to wait for a message in ms, 0 to return immediately, -1 to wait forever
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_TIMEOUT
+		 */
+		int receive( const std::string &channel, std::string &message, int timeout );
+		
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * event-queue.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "event-queue.h"
+
+/**
+ * @copydoc macrodevice::pack_event
+ */
+bool macrodevice::pack_event( void *device, const macrodevice::event &event, queued_event &record )
+{
+	record.device = device;
+	record.event = event;
+	
+	// copy the payload, the pointer gets fixed in unpack_event
+	if( event.payload )
+	{
+		record.event.payload_size = std::min( event.payload_size, (size_t)MACRODEVICE_QUEUE_PAYLOAD_SIZE );
+		std::memcpy( record.payload, event.payload, record.event.payload_size );
+	}
+	
+	return record.event.payload_size == event.payload_size;
+}
+
+/**
+ * @copydoc macrodevice::unpack_event
+ */
+void macrodevice::unpack_event( const queued_event &record, macrodevice::event &event )
+{
+	event = record.event;
+	
+	if( event.payload )
+		event.payload = record.payload;
+}
+
+macrodevice::event_queue::event_queue() : m_cells( new cell[MACRODEVICE_QUEUE_SIZE] )
+{
+	// every cell is free for the push at its position
+	for( size_t i = 0; i < MACRODEVICE_QUEUE_SIZE; i++ )
+		m_cells[i].sequence.store( i, std::memory_order_relaxed );
+}
+
+/**
+ * @copydoc macrodevice::event_queue::push
+ */
+bool macrodevice::event_queue::push( const queued_event &event )
+{
+	cell *c;
+	size_t position = m_enqueue_pos.load( std::memory_order_relaxed );
+	
+	// claim a free cell
+	while( true )
+	{
+		c = &m_cells[position & m_mask];
+		size_t sequence = c->sequence.load( std::memory_order_acquire );
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		
+		if( difference == 0 )
+		{
+			if( m_enqueue_pos.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+				break;
+		}
+		else if( difference < 0 )
+		{
+			// the cell still holds the record from the previous round: the queue is full
+			return false;
+		}
+		else
+		{
+			// another thread has claimed the cell
+			position = m_enqueue_pos.load( std::memory_order_relaxed );
+		}
+	}
+	
+	// store the record and publish it
+	c->event = event;
+	c->sequence.store( position + 1, std::memory_order_release );
+	
+	m_pushed.fetch_add( 1, std::memory_order_release );
+	m_pushed.notify_one();
+	
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::event_queue::pop
+ */
+bool macrodevice::event_queue::pop( queued_event &event )
+{
+	cell *c;
+	size_t position = m_dequeue_pos.load( std::memory_order_relaxed );
+	
+	// claim a filled cell
+	while( true )
+	{
+		c = &m_cells[position & m_mask];
+		size_t sequence = c->sequence.load( std::memory_order_acquire );
+		intptr_t difference = (intptr_t)sequence - (intptr_t)( position + 1 );
+		
+		if( difference == 0 )
+		{
+			if( m_dequeue_pos.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+				break;
+		}
+		else if( difference < 0 )
+		{
+			// the cell hasn't been filled: the queue is empty
+			return false;
+		}
+		else
+		{
+			// another thread has claimed the cell
+			position = m_dequeue_pos.load( std::memory_order_relaxed );
+		}
+	}
+	
+	// copy the record and free the cell for the next round
+	event = c->event;
+	c->sequence.store( position + m_mask + 1, std::memory_order_release );
+	
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::event_queue::wait_token
+ */
+uint32_t macrodevice::event_queue::wait_token() const
+{
+	return m_pushed.load( std::memory_order_acquire );
+}
+
+/**
+ * @copydoc macrodevice::event_queue::wait
+ */
+void macrodevice::event_queue::wait( uint32_t token ) const
+{
+	m_pushed.wait( token, std::memory_order_acquire );
+}
+
+/**
+ * @copydoc macrodevice::event_queue::wake
+ */
+void macrodevice::event_queue::wake()
+{
+	m_pushed.fetch_add( 1, std::memory_order_release );
+	m_pushed.notify_all();
+}
+
+/**
+ * @copydoc macrodevice::event_queue::size
+ */
+size_t macrodevice::event_queue::size() const
+{
+	size_t enqueue = m_enqueue_pos.load( std::memory_order_relaxed );
+	size_t dequeue = m_dequeue_pos.load( std::memory_order_relaxed );
+	
+	return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+/**
+ * @copydoc macrodevice::event_queue::capacity
+ */
+size_t macrodevice::event_queue::capacity() const
+{
+	return MACRODEVICE_QUEUE_SIZE;
+}
@@ -0,0 +1,154 @@
+/*
+ * event-queue.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_EVENT_QUEUE
+#define MACRODEVICE_EVENT_QUEUE
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "backends/helpers.h"
+
+/// Number of records in the event queue, must be a power of two
+#define MACRODEVICE_QUEUE_SIZE 4096
+
+/// Number of bytes available for the payload of a queued event
+#define MACRODEVICE_QUEUE_PAYLOAD_SIZE 160
+
+namespace macrodevice
+{
+	/**
+	 * A fixed size event record, as stored in the event queue
+	 */
+	struct queued_event
+	{
+		/// the device the event belongs to, not used by the queue
+		void *device;
+		
+		/// the handler of the event, not used by the queue
+		int handler;
+		
+		/// the event, the payload pointer is only valid after unpack_event
+		macrodevice::event event;
+		
+		/// a copy of the payload
+		char payload[MACRODEVICE_QUEUE_PAYLOAD_SIZE];
+	};
+	
+	/**
+	 * Stores an event in a record, a payload that doesn't fit gets truncated
+	 * @param device The device the event belongs to
+	 * @param event The event
+	 * @param record The record
+	 * @return false if the payload has been truncated
+	 */
+	bool pack_event( void *device, const macrodevice::event &event, queued_event &record );
+	
+	/**
+	 * Reads an event from a record
+	 * @param record The record, the payload of the event points into this record
+	 * @param event The event, the previous content gets replaced
+	 */
+	void unpack_event( const queued_event &record, macrodevice::event &event );
+	
+	class event_queue;
+}
+
+/**
+ * A bounded lock-free queue for events, any thread can push and pop.
+ * Based on the bounded MPMC queue by Dmitry Vyukov.
+ */
+class macrodevice::event_queue
+{
+	
+	private:
+		
+		/// A slot in the queue, sequence tells if the slot is free or holds a record
+		struct cell
+		{
+			std::atomic< size_t > sequence;
+			queued_event event;
+		};
+		
+		std::unique_ptr< cell[] > m_cells;
+		
+		static constexpr size_t m_mask = MACRODEVICE_QUEUE_SIZE - 1;
+		
+		/// position of the next push, on a separate cache line from m_dequeue_pos
+		alignas( 64 ) std::atomic< size_t > m_enqueue_pos = 0;
+		
+		/// position of the next pop
+		alignas( 64 ) std::atomic< size_t > m_dequeue_pos = 0;
+		
+		/// incremented on every push, used to wait for new records
+		alignas( 64 ) std::atomic< uint32_t > m_pushed = 0;
+		
+	public:
+		
+		event_queue();
+		
+		/**
+		 * Appends a record to the queue
+		 * @param event The record
+		 * @return false if the queue is full
+		 */
+		bool push( const queued_event &event );
+		
+		/**
+		 * Removes the oldest record from the queue
+		 * @param event The removed record
+		 * @return false if the queue is empty
+		 */
+		bool pop( queued_event &event );
+		
+		/**
+		 * Returns the value to pass to wait(), this needs to be called before checking if the queue is empty
+		 */
+		uint32_t wait_token() const;
+		
+		/**
+		 * Waits until a record has been pushed or wake() has been called since wait_token() has returned token
+		 */
+		void wait( uint32_t token ) const;
+		
+		/**
+		 * Wakes up a thread waiting in wait()
+		 */
+		void wake();
+		
+		/**
+		 * Returns the approximate number of records in the queue
+		 */
+		size_t size() const;
+		
+		/**
+		 * Returns the maximum number of records in the queue
+		 */
+		size_t capacity() const;
+		
+};
+
+#endif
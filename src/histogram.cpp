@@ -0,0 +1,115 @@
+/*
+ * histogram.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "histogram.h"
+
+/**
+ * @copydoc macrodevice::histogram::bucket
+ */
+unsigned int macrodevice::histogram::bucket( uint64_t value )
+{
+	const unsigned int sub_count = 1u << MACRODEVICE_HISTOGRAM_SUB_BITS;
+	
+	// small values have their own bucket
+	if( value < sub_count )
+		return value;
+	
+	// the position of the highest bit selects the power of two, the following bits the sub-bucket
+	unsigned int exponent = 63 - __builtin_clzll( value );
+	unsigned int sub = ( value >> ( exponent - MACRODEVICE_HISTOGRAM_SUB_BITS ) ) & ( sub_count - 1 );
+	
+	return ( ( exponent - MACRODEVICE_HISTOGRAM_SUB_BITS + 1 ) << MACRODEVICE_HISTOGRAM_SUB_BITS ) + sub;
+}
+
+/**
+ * @copydoc macrodevice::histogram::bucket_start
+ */
+uint64_t macrodevice::histogram::bucket_start( unsigned int bucket )
+{
+	const unsigned int sub_count = 1u << MACRODEVICE_HISTOGRAM_SUB_BITS;
+	
+	if( bucket < sub_count )
+		return bucket;
+	
+	unsigned int exponent = ( bucket >> MACRODEVICE_HISTOGRAM_SUB_BITS ) + MACRODEVICE_HISTOGRAM_SUB_BITS - 1;
+	uint64_t sub = bucket & ( sub_count - 1 );
+	
+	return ( sub_count + sub ) << ( exponent - MACRODEVICE_HISTOGRAM_SUB_BITS );
+}
+
+/**
+ * @copydoc macrodevice::histogram::record
+ */
+void macrodevice::histogram::record( uint64_t value )
+{
+	m_buckets[bucket( value )].fetch_add( 1, std::memory_order_relaxed );
+	m_count.fetch_add( 1, std::memory_order_relaxed );
+	
+	uint64_t max = m_max.load( std::memory_order_relaxed );
+	while( value > max && !m_max.compare_exchange_weak( max, value, std::memory_order_relaxed ) );
+}
+
+/**
+ * @copydoc macrodevice::histogram::percentile
+ */
+uint64_t macrodevice::histogram::percentile( double fraction ) const
+{
+	uint64_t count = m_count.load( std::memory_order_relaxed );
+	if( count == 0 )
+		return 0;
+	
+	// the rank of the value, starting at 1
+	uint64_t rank = fraction * count;
+	if( rank < 1 )
+		rank = 1;
+	
+	uint64_t seen = 0;
+	for( unsigned int i = 0; i < MACRODEVICE_HISTOGRAM_BUCKETS; i++ )
+	{
+		seen += m_buckets[i].load( std::memory_order_relaxed );
+		if( seen >= rank )
+		{
+			// the middle of the bucket, but not above the largest value
+			uint64_t start = bucket_start( i );
+			uint64_t end = i+1 < MACRODEVICE_HISTOGRAM_BUCKETS ? bucket_start( i+1 ) : UINT64_MAX;
+			uint64_t value = start + ( end - start ) / 2;
+			
+			return value < max() ? value : max();
+		}
+	}
+	
+	return max();
+}
+
+/**
+ * @copydoc macrodevice::histogram::count
+ */
+uint64_t macrodevice::histogram::count() const
+{
+	return m_count.load( std::memory_order_relaxed );
+}
+
+/**
+ * @copydoc macrodevice::histogram::max
+ */
+uint64_t macrodevice::histogram::max() const
+{
+	return m_max.load( std::memory_order_relaxed );
+}
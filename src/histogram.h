@@ -0,0 +1,86 @@
+/*
+ * histogram.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_HISTOGRAM
+#define MACRODEVICE_HISTOGRAM
+
+#include <atomic>
+#include <cstdint>
+
+/// Number of sub-buckets per power of two, as a power of two
+#define MACRODEVICE_HISTOGRAM_SUB_BITS 3
+
+/// Number of buckets, enough for all 64 bit values
+#define MACRODEVICE_HISTOGRAM_BUCKETS ( ( 64 - MACRODEVICE_HISTOGRAM_SUB_BITS + 1 ) << MACRODEVICE_HISTOGRAM_SUB_BITS )
+
+namespace macrodevice
+{
+	class histogram;
+}
+
+/**
+ * A log-linear histogram of durations in ns: each power of two is split into 8 buckets, so the relative error is below 12.5%.
+ * Recording is lock-free and can happen in any thread.
+ */
+class macrodevice::histogram
+{
+	
+	private:
+		
+		std::atomic< uint64_t > m_buckets[MACRODEVICE_HISTOGRAM_BUCKETS] = {};
+		
+		std::atomic< uint64_t > m_count = 0;
+		std::atomic< uint64_t > m_max = 0;
+		
+		/// Returns the bucket of a value
+		static unsigned int bucket( uint64_t value );
+		
+		/// Returns the smallest value in a bucket
+		static uint64_t bucket_start( unsigned int bucket );
+		
+	public:
+		
+		/**
+		 * Adds a value
+		 * @param value The duration in ns
+		 */
+		void record( uint64_t value );
+		
+		/**
+		 * Returns the approximate value below which the given fraction of the values lie
+		 * @param fraction Between 0 and 1, e.g. 0.99
+		 * @return The value in ns, 0 if the histogram is empty
+		 */
+		uint64_t percentile( double fraction ) const;
+		
+		/**
+		 * Returns the number of recorded values
+		 */
+		uint64_t count() const;
+		
+		/**
+		 * Returns the largest recorded value
+		 */
+		uint64_t max() const;
+		
+};
+
+#endif
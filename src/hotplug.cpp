@@ -0,0 +1,315 @@
+/*
+ * hotplug.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "hotplug.h"
+
+macrodevice::hotplug::~hotplug()
+{
+	if( m_thread.joinable() )
+	{
+		m_thread.request_stop();
+		wake();
+		m_thread.join();
+	}
+	
+	if( m_wakefd >= 0 )
+		close( m_wakefd );
+	if( m_socket >= 0 )
+		close( m_socket );
+}
+
+/**
+ * @copydoc macrodevice::hotplug::add_watch
+ */
+int macrodevice::hotplug::add_watch( std::function< bool() > reopen, std::function< void() > cancel, std::stop_token stop )
+{
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	// create the eventfd and the uevent socket on first use
+	if( m_wakefd < 0 )
+	{
+		m_wakefd = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+		if( m_wakefd < 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		
+		// without uevents (e.g. in a container) the devices are only reopened periodically
+		m_socket = socket( AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT );
+		if( m_socket >= 0 )
+		{
+			struct sockaddr_nl address = {};
+			address.nl_family = AF_NETLINK;
+			address.nl_groups = MACRODEVICE_HOTPLUG_GROUPS;
+			
+			if( bind( m_socket, (struct sockaddr*)&address, sizeof( address ) ) != 0 )
+			{
+				close( m_socket );
+				m_socket = -1;
+			}
+		}
+	}
+	
+	uint64_t id = m_next_id++;
+	watch &w = m_watches[id];
+	w.reopen = std::move( reopen );
+	w.cancel = std::move( cancel );
+	w.stop = stop;
+	w.wake = std::make_unique< std::stop_callback< std::function< void() > > >( stop, [this](){ wake(); } );
+	
+	// (re)start the supervisor
+	if( !m_running )
+	{
+		if( m_thread.joinable() )
+			m_thread.join();
+		
+		m_running = true;
+		m_thread = std::jthread( [this]( std::stop_token st ){ run( st ); } );
+	}
+	else
+	{
+		wake();
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::hotplug::reconnect
+ */
+bool macrodevice::hotplug::reconnect( std::function< bool() > reopen, std::stop_token stop )
+{
+	// shared with the supervisor thread, which may still hold it after the result has been set
+	auto result = std::make_shared< std::promise< bool > >();
+	std::future< bool > reopened = result->get_future();
+	
+	auto attempt = [result, reopen = std::move( reopen )]() -> bool
+	{
+		if( !reopen() )
+			return false;
+		
+		result->set_value( true );
+		return true;
+	};
+	
+	if( add_watch( attempt, [result](){ result->set_value( false ); }, stop ) != MACRODEVICE_SUCCESS )
+	{
+		return false;
+	}
+	
+	return reopened.get();
+}
+
+/**
+ * @copydoc macrodevice::hotplug::wake
+ */
+void macrodevice::hotplug::wake()
+{
+	if( m_wakefd >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wakefd, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, the supervisor is awake anyway
+		}
+	}
+}
+
+/**
+ * @copydoc macrodevice::hotplug::join
+ */
+bool macrodevice::hotplug::join()
+{
+	std::jthread thread;
+	
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		thread = std::move( m_thread );
+	}
+	
+	if( !thread.joinable() )
+		return false;
+	
+	thread.join();
+	return true;
+}
+
+/**
+ * @copydoc macrodevice::hotplug::device_added
+ */
+bool macrodevice::hotplug::device_added()
+{
+	bool added = false;
+	char buffer[8192];
+	
+	while( true )
+	{
+		ssize_t size = recv( m_socket, buffer, sizeof( buffer ), MSG_DONTWAIT );
+		if( size < 0 )
+		{
+			// uevents have been lost because the socket buffer was full, one of them could have been an added device
+			if( errno == ENOBUFS )
+			{
+				added = true;
+				continue;
+			}
+			
+			return added;
+		}
+		
+		// kernel uevents ("add@/devices/...") and udev uevents (with a binary header) both contain the properties
+		// as null terminated strings, a spoofed uevent would only cause an extra attempt to reopen the devices
+		if( memmem( buffer, size, "ACTION=add", sizeof( "ACTION=add" ) ) != NULL )
+			added = true;
+	}
+}
+
+/**
+ * @copydoc macrodevice::hotplug::run
+ */
+void macrodevice::hotplug::run( std::stop_token st )
+{
+	std::vector< uint64_t > due;
+	
+	while( true )
+	{
+		// remove all watches with a requested stop, or all watches if the supervisor is stopped
+		std::vector< std::function< void() > > cancelled;
+		{
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			
+			for( auto w = m_watches.begin(); w != m_watches.end(); )
+			{
+				if( w->second.stop.stop_requested() || st.stop_requested() )
+				{
+					cancelled.push_back( std::move( w->second.cancel ) );
+					w = m_watches.erase( w );
+				}
+				else
+				{
+					w++;
+				}
+			}
+		}
+		
+		// the cancel functions are called without holding the mutex, as they may add new watches
+		for( auto &cancel : cancelled )
+		{
+			if( cancel )
+				cancel();
+		}
+		
+		// quit if there is nothing left to do, find the next attempt
+		uint64_t now = macrodevice::monotonic_ns();
+		uint64_t next_attempt = UINT64_MAX;
+		{
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			
+			if( m_watches.empty() || st.stop_requested() )
+			{
+				m_running = false;
+				return;
+			}
+			
+			for( auto &w : m_watches )
+				next_attempt = std::min( next_attempt, w.second.next_attempt );
+		}
+		
+		// wait for a uevent, a wakeup or the next attempt
+		if( next_attempt > now )
+		{
+			struct pollfd fds[2];
+			fds[0].fd = m_wakefd;
+			fds[0].events = POLLIN;
+			fds[1].fd = m_socket;
+			fds[1].events = POLLIN;
+			
+			int timeout = ( next_attempt - now + 999999 ) / 1000000;
+			if( poll( fds, m_socket >= 0 ? 2 : 1, timeout ) < 0 && errno != EINTR )
+			{
+				const std::lock_guard<std::mutex> lock( m_mutex );
+				m_running = false;
+				return;
+			}
+			
+			if( fds[0].revents & POLLIN )
+			{
+				uint64_t value;
+				if( read( m_wakefd, &value, sizeof( value ) ) < 0 )
+				{
+					// already reset
+				}
+			}
+		}
+		
+		bool added = m_socket >= 0 && device_added();
+		
+		// find the watches with a due attempt, after a new device all of them are due
+		now = macrodevice::monotonic_ns();
+		{
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			
+			for( auto &w : m_watches )
+			{
+				if( added )
+				{
+					w.second.next_attempt = now;
+					w.second.retries = MACRODEVICE_HOTPLUG_RETRIES;
+				}
+				
+				if( w.second.next_attempt <= now && !w.second.stop.stop_requested() )
+					due.push_back( w.first );
+			}
+		}
+		
+		for( auto id : due )
+		{
+			// the pointer stays valid as watches are only erased by this thread
+			watch *w = NULL;
+			{
+				const std::lock_guard<std::mutex> lock( m_mutex );
+				
+				auto it = m_watches.find( id );
+				if( it != m_watches.end() )
+					w = &it->second;
+			}
+			
+			if( w == NULL )
+				continue;
+			
+			// reopen the device, the mutex is not held as reopen may add new watches
+			bool reopened = w->reopen();
+			
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			if( reopened )
+			{
+				m_watches.erase( id );
+			}
+			else
+			{
+				w->next_attempt = macrodevice::monotonic_ns() + 1000000ull *
+					( w->retries > 0 ? MACRODEVICE_HOTPLUG_RETRY_INTERVAL : MACRODEVICE_HOTPLUG_INTERVAL );
+				if( w->retries > 0 )
+					w->retries--;
+			}
+		}
+		due.clear();
+	}
+}
@@ -0,0 +1,160 @@
+/*
+ * hotplug.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_HOTPLUG
+#define MACRODEVICE_HOTPLUG
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <stop_token>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <unistd.h> // for close()
+
+#include "backends/helpers.h"
+
+/// Time between attempts to reopen a device in ms, if no device has been added
+#define MACRODEVICE_HOTPLUG_INTERVAL 1000
+
+/// After a device has been added, udev may still be creating its links and setting its permissions:
+/// the attempts get repeated MACRODEVICE_HOTPLUG_RETRIES times with MACRODEVICE_HOTPLUG_RETRY_INTERVAL ms in between
+#define MACRODEVICE_HOTPLUG_RETRIES 25
+#define MACRODEVICE_HOTPLUG_RETRY_INTERVAL 20
+
+/// Netlink multicast groups of the uevents: 1 from the kernel, 2 from udev (after its rules have been applied)
+#define MACRODEVICE_HOTPLUG_GROUPS 3
+
+namespace macrodevice
+{
+	class hotplug;
+}
+
+/**
+ * Reopens lost devices, e.g. after they have been unplugged.
+ * Each lost device is added as a watch: a function that tries to reopen it, which gets called
+ * whenever a device has been added (uevents from the kernel and udev) and periodically as a fallback.
+ * The thread of the supervisor only runs while there are watches.
+ */
+class macrodevice::hotplug
+{
+	
+	private:
+		
+		/// A lost device
+		struct watch
+		{
+			/// tries to reopen the device, returns true if successful
+			std::function< bool() > reopen;
+			
+			/// called instead of reopen when a stop is requested
+			std::function< void() > cancel;
+			
+			/// the watch gets removed when a stop is requested
+			std::stop_token stop;
+			
+			/// wakes up the supervisor when a stop is requested
+			std::unique_ptr< std::stop_callback< std::function< void() > > > wake;
+			
+			/// time of the next attempt in ns of CLOCK_MONOTONIC, and the remaining quick attempts
+			uint64_t next_attempt = 0;
+			unsigned int retries = 0;
+		};
+		
+		/// netlink socket receiving uevents, -1 if it couldn't be opened
+		int m_socket = -1;
+		
+		/// eventfd used to wake up the supervisor
+		int m_wakefd = -1;
+		
+		/// id of the next watch
+		uint64_t m_next_id = 1;
+		
+		/// all watches, guarded by m_mutex
+		std::map< uint64_t, watch > m_watches;
+		
+		/// is run() currently executing? guarded by m_mutex
+		bool m_running = false;
+		
+		std::mutex m_mutex;
+		
+		/// the thread executing run()
+		std::jthread m_thread;
+		
+		/**
+		 * Reads all pending uevents
+		 * @return true if a device has been added
+		 */
+		bool device_added();
+		
+		/**
+		 * Tries to reopen the devices, returns when all watches have been removed or a stop is requested
+		 * @param st Stop token
+		 */
+		void run( std::stop_token st );
+		
+	public:
+		
+		~hotplug();
+		
+		/**
+		 * Adds a lost device, starts the supervisor thread if it isn't running
+		 * The first attempt to reopen the device is made immediately.
+		 * @param reopen Tries to reopen the device, returns true if successful, called by the supervisor thread
+		 * @param cancel Called by the supervisor thread when a stop is requested before the device has been reopened
+		 * @param stop Stop token of the device
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int add_watch( std::function< bool() > reopen, std::function< void() > cancel, std::stop_token stop );
+		
+		/**
+		 * Blocks until a lost device has been reopened or a stop is requested, used by the device threads
+		 * @param reopen Tries to reopen the device, returns true if successful, called by the supervisor thread
+		 * @param stop Stop token of the device
+		 * @return true if the device has been reopened
+		 */
+		bool reconnect( std::function< bool() > reopen, std::stop_token stop );
+		
+		/**
+		 * Wakes up the supervisor thread, so that stop requests are noticed
+		 */
+		void wake();
+		
+		/**
+		 * Waits until all watches have been removed
+		 * @return true if there were any watches
+		 */
+		bool join();
+		
+};
+
+#endif
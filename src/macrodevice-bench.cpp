@@ -0,0 +1,460 @@
+/*
+ * macrodevice-bench.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+
+// standard libraries
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <memory>
+#include <exception>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+
+#include <getopt.h> // getopt_long
+#include <fcntl.h> // for open()
+#include <unistd.h> // for write()
+#include <poll.h>
+#include <spawn.h> // posix_spawn
+#include <sys/ioctl.h>
+#include <sys/resource.h> // for wait4
+#include <sys/wait.h> // for wait4
+#include <linux/uinput.h>
+
+#include "backends/helpers.h"
+#include "histogram.h"
+
+extern char **environ;
+
+// help message
+//**********************************************************************
+const std::string help_message = R"(macrodevice-bench options:
+
+-h --help     print this message
+-r --rate     events per second (default: 1000)
+-n --count    number of events (default: 10000)
+-m --mode     how the device is handled: thread, reactor, queue, isolated or frame (default: thread)
+-b --binary   path of macrodevice-lua (default: ./macrodevice-lua)
+-c --config   the config passed to macrodevice-lua (default: ./examples/bench.lua)
+
+Creates a virtual keyboard through /dev/uinput, sends key events with a
+sequence number (EV_MSC MSC_SCAN) and measures when macrodevice-lua has
+passed them to the event handler. Requires write access to /dev/uinput.
+
+Licensed under the GNU GPL v3 or later
+)";
+
+/// Maximum time in ms to wait for macrodevice-lua to open the device
+#define BENCH_READY_TIMEOUT 5000
+
+/// Time in ms after the last event was sent until the remaining events are counted as lost
+#define BENCH_DRAIN_TIMEOUT 2000
+
+/// Maximum time in ms to wait for the event node of the virtual device
+#define BENCH_DEVICE_TIMEOUT 2000
+
+/// Interval in ms between the probes sent until macrodevice-lua passes one to the event handler
+#define BENCH_PROBE_INTERVAL 20
+
+/// The sequence number of a probe, see wait_for_device()
+#define BENCH_PROBE -1
+
+/// Creates the virtual keyboard, returns the file descriptor of /dev/uinput or -1 in case of failure
+int create_device( std::string &eventfile )
+{
+	int fd = open( "/dev/uinput", O_WRONLY|O_CLOEXEC );
+	if( fd < 0 )
+	{
+		std::cerr << "Error: Could not open /dev/uinput: " << strerror( errno ) << "\n";
+		return -1;
+	}
+	
+	// a keyboard with a single key, which reports the scancode like real keyboards do
+	struct uinput_setup setup = {};
+	setup.id.bustype = BUS_VIRTUAL;
+	setup.id.vendor = 0x6d64; // "md"
+	setup.id.product = 0x6265; // "be"
+	strncpy( setup.name, "macrodevice-bench", UINPUT_MAX_NAME_SIZE - 1 );
+	
+	if( ioctl( fd, UI_SET_EVBIT, EV_SYN ) < 0 ||
+		ioctl( fd, UI_SET_EVBIT, EV_KEY ) < 0 ||
+		ioctl( fd, UI_SET_EVBIT, EV_MSC ) < 0 ||
+		ioctl( fd, UI_SET_KEYBIT, KEY_A ) < 0 ||
+		ioctl( fd, UI_SET_MSCBIT, MSC_SCAN ) < 0 ||
+		ioctl( fd, UI_DEV_SETUP, &setup ) < 0 ||
+		ioctl( fd, UI_DEV_CREATE ) < 0 )
+	{
+		std::cerr << "Error: Could not create the virtual device: " << strerror( errno ) << "\n";
+		close( fd );
+		return -1;
+	}
+	
+	// find the event node, e.g. /sys/class/input/input23/event20
+	char sysname[64] = {};
+	if( ioctl( fd, UI_GET_SYSNAME( sizeof( sysname ) ), sysname ) < 0 )
+	{
+		std::cerr << "Error: Could not get the name of the virtual device: " << strerror( errno ) << "\n";
+		close( fd );
+		return -1;
+	}
+	
+	try
+	{
+		for( auto &entry : std::filesystem::directory_iterator( std::string( "/sys/class/input/" ) + sysname ) )
+		{
+			if( entry.path().filename().string().starts_with( "event" ) )
+				eventfile = "/dev/input/" + entry.path().filename().string();
+		}
+	}
+	catch( std::exception &e ){}
+	
+	if( eventfile.empty() )
+	{
+		std::cerr << "Error: Could not find the event node of the virtual device\n";
+		close( fd );
+		return -1;
+	}
+	
+	// wait until udev has set up the permissions of the event node
+	uint64_t start = macrodevice::monotonic_ns();
+	while( access( eventfile.c_str(), R_OK ) != 0 && macrodevice::monotonic_ns() - start < BENCH_DEVICE_TIMEOUT * 1000000ull )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	}
+	
+	return fd;
+}
+
+/// Sends count frames at the given rate, stores the time each frame was sent in sent
+void send_events( std::stop_token st, int fd, int count, double rate, std::vector< std::atomic< uint64_t > > &sent )
+{
+	uint64_t start = macrodevice::monotonic_ns();
+	
+	for( int i = 0; i < count && !st.stop_requested(); i++ )
+	{
+		// wait until the frame is due
+		uint64_t due = start + (uint64_t)( i * 1e9 / rate );
+		struct timespec due_spec = { (time_t)( due / 1000000000 ), (long)( due % 1000000000 ) };
+		clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due_spec, NULL );
+		
+		struct input_event frame[3] = {};
+		frame[0].type = EV_MSC;
+		frame[0].code = MSC_SCAN;
+		frame[0].value = i;
+		frame[1].type = EV_KEY;
+		frame[1].code = KEY_A;
+		frame[1].value = ( i % 2 == 0 ) ? 1 : 0;
+		frame[2].type = EV_SYN;
+		frame[2].code = SYN_REPORT;
+		
+		sent[i].store( macrodevice::monotonic_ns(), std::memory_order_release );
+		if( write( fd, frame, sizeof( frame ) ) != sizeof( frame ) )
+		{
+			std::cerr << "Warning: Could not send event " << i << "\n";
+		}
+	}
+	
+	// don't leave the key pressed
+	if( count % 2 == 1 )
+	{
+		struct input_event release[2] = {};
+		release[0].type = EV_KEY;
+		release[0].code = KEY_A;
+		release[1].type = EV_SYN;
+		release[1].code = SYN_REPORT;
+		if( write( fd, release, sizeof( release ) ) != sizeof( release ) )
+		{
+			std::cerr << "Warning: Could not release the key\n";
+		}
+	}
+}
+
+/// Reads a line from fd, waiting up to timeout ms for more data, returns false on timeout, error or end of file
+/// closed gets set to true on error or end of file
+bool read_line( int fd, std::string &buffer, std::string &line, int timeout, bool &closed )
+{
+	while( true )
+	{
+		size_t newline = buffer.find( '\n' );
+		if( newline != std::string::npos )
+		{
+			line = buffer.substr( 0, newline );
+			buffer.erase( 0, newline + 1 );
+			return true;
+		}
+		
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if( poll( &pfd, 1, timeout ) <= 0 )
+			return false;
+		
+		char data[4096];
+		ssize_t size = read( fd, data, sizeof( data ) );
+		if( size <= 0 )
+		{
+			closed = true;
+			return false;
+		}
+		buffer.append( data, size );
+	}
+}
+
+/// Sends probes until macrodevice-lua has passed one to the event handler, returns false on timeout or if macrodevice-lua has quit
+/// "ready" only means that the config has been loaded, the device thread might not have opened the device yet
+bool wait_for_device( int fd, int output, std::string &buffer, bool &closed )
+{
+	uint64_t start = macrodevice::monotonic_ns();
+	
+	while( macrodevice::monotonic_ns() - start < BENCH_READY_TIMEOUT * 1000000ull )
+	{
+		// a probe doesn't change the key state, so it can be sent repeatedly
+		struct input_event probe[2] = {};
+		probe[0].type = EV_MSC;
+		probe[0].code = MSC_SCAN;
+		probe[0].value = BENCH_PROBE;
+		probe[1].type = EV_SYN;
+		probe[1].code = SYN_REPORT;
+		if( write( fd, probe, sizeof( probe ) ) != sizeof( probe ) )
+			return false;
+		
+		std::string line;
+		while( read_line( output, buffer, line, BENCH_PROBE_INTERVAL, closed ) )
+		{
+			if( line == std::to_string( BENCH_PROBE ) )
+				return true;
+		}
+		
+		if( closed )
+			return false;
+	}
+	
+	return false;
+}
+
+// main function
+//**********************************************************************
+int main( int argc, char *argv[] )
+{
+	// commandline arguments
+	//******************************************************************
+	static struct option long_options[] = 
+	{
+		{"help", no_argument, 0, 'h'},
+		{"rate", required_argument, 0, 'r'},
+		{"count", required_argument, 0, 'n'},
+		{"mode", required_argument, 0, 'm'},
+		{"binary", required_argument, 0, 'b'},
+		{"config", required_argument, 0, 'c'},
+		{0, 0, 0, 0}
+	};
+	
+	int c, option_index = 0;
+	double rate = 1000;
+	int count = 10000;
+	std::string mode = "thread", binary = "./macrodevice-lua", config = "./examples/bench.lua";
+	
+	try
+	{
+		while( (c = getopt_long( argc, argv, "hr:n:m:b:c:", long_options, &option_index ) ) != -1 )
+		{
+			switch( c )
+			{
+				case 'h':
+					std::cout << help_message;
+					return 0;
+				case 'r':
+					rate = std::stod( optarg );
+					break;
+				case 'n':
+					count = std::stoi( optarg );
+					break;
+				case 'm':
+					mode = optarg;
+					break;
+				case 'b':
+					binary = optarg;
+					break;
+				case 'c':
+					config = optarg;
+					break;
+				default:
+					return 1;
+			}
+		}
+	}
+	catch( std::exception &e )
+	{
+		std::cerr << "Error: Invalid argument\n";
+		return 1;
+	}
+	
+	if( rate <= 0 || count <= 0 )
+	{
+		std::cerr << "Error: rate and count must be positive\n";
+		return 1;
+	}
+	
+	// create the virtual device
+	//******************************************************************
+	std::string eventfile;
+	int uinput_fd = create_device( eventfile );
+	if( uinput_fd < 0 )
+		return 1;
+	
+	// start macrodevice-lua, its stdout is read through a pipe
+	//******************************************************************
+	int output[2];
+	if( pipe2( output, O_CLOEXEC ) < 0 )
+	{
+		std::cerr << "Error: Could not create a pipe\n";
+		return 1;
+	}
+	
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init( &actions );
+	posix_spawn_file_actions_adddup2( &actions, output[1], STDOUT_FILENO );
+	
+	std::vector< std::string > args = { binary, "-c", config, "-a", eventfile, "-a", mode };
+	std::vector< char* > child_argv;
+	for( auto &a : args )
+		child_argv.push_back( a.data() );
+	child_argv.push_back( NULL );
+	
+	pid_t child;
+	int spawn_status = posix_spawn( &child, binary.c_str(), &actions, NULL, child_argv.data(), environ );
+	posix_spawn_file_actions_destroy( &actions );
+	close( output[1] );
+	
+	if( spawn_status != 0 )
+	{
+		std::cerr << "Error: Could not start " << binary << ": " << strerror( spawn_status ) << "\n";
+		return 1;
+	}
+	
+	std::string buffer, line;
+	bool closed = false;
+	if( !read_line( output[0], buffer, line, BENCH_READY_TIMEOUT, closed ) || line != "ready" ||
+		!wait_for_device( uinput_fd, output[0], buffer, closed ) )
+	{
+		std::cerr << "Error: " << binary << " didn't open the virtual device\n";
+		kill( child, SIGTERM );
+		waitpid( child, NULL, 0 );
+		return 1;
+	}
+	
+	// send the events and wait for their sequence numbers
+	//******************************************************************
+	std::vector< std::atomic< uint64_t > > sent( count );
+	std::atomic< bool > sending = true;
+	
+	uint64_t start = macrodevice::monotonic_ns();
+	std::jthread sender( [&]( std::stop_token st )
+	{
+		send_events( st, uinput_fd, count, rate, sent );
+		sending = false;
+	} );
+	
+	macrodevice::histogram latency;
+	std::vector< bool > received( count, false );
+	int received_count = 0, invalid_count = 0;
+	uint64_t last_received = start;
+	
+	while( received_count < count )
+	{
+		// after the last event has been sent, the missing events are lost
+		if( !read_line( output[0], buffer, line, BENCH_DRAIN_TIMEOUT, closed ) )
+		{
+			if( closed )
+			{
+				std::cerr << "Error: " << binary << " has quit\n";
+				break;
+			}
+			if( sending )
+				continue;
+			break;
+		}
+		
+		uint64_t now = macrodevice::monotonic_ns();
+		
+		int sequence = -1;
+		try
+		{
+			sequence = std::stoi( line );
+		}
+		catch( std::exception &e ){}
+		
+		// probes that were still in flight when the first one arrived
+		if( sequence == BENCH_PROBE )
+			continue;
+		
+		if( sequence < 0 || sequence >= count || received[sequence] )
+		{
+			invalid_count++;
+			continue;
+		}
+		
+		uint64_t sent_time = sent[sequence].load( std::memory_order_acquire );
+		latency.record( now - std::min( now, sent_time ) );
+		received[sequence] = true;
+		received_count++;
+		last_received = now;
+	}
+	
+	sender.request_stop();
+	sender.join();
+	
+	// stop macrodevice-lua and get its resource usage
+	//******************************************************************
+	kill( child, SIGTERM );
+	int status;
+	struct rusage usage = {};
+	wait4( child, &status, 0, &usage );
+	close( output[0] );
+	
+	ioctl( uinput_fd, UI_DEV_DESTROY );
+	close( uinput_fd );
+	
+	// report
+	//******************************************************************
+	double duration = ( last_received - start ) / 1e9;
+	double cpu_user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	double cpu_system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	
+	std::cout << std::fixed << std::setprecision( 1 );
+	std::cout << "mode:            " << mode << "\n";
+	std::cout << "events sent:     " << count << " at " << rate << "/s\n";
+	std::cout << "events received: " << received_count << " (" << ( count - received_count ) << " lost";
+	if( invalid_count > 0 )
+		std::cout << ", " << invalid_count << " invalid lines";
+	std::cout << ")\n";
+	std::cout << "throughput:      " << ( duration > 0 ? received_count / duration : 0 ) << " events/s\n";
+	std::cout << "cpu time:        " << ( cpu_user + cpu_system ) * 1e3 << " ms (user " << cpu_user * 1e3 << " ms, system " << cpu_system * 1e3 << " ms), "
+		<< ( received_count > 0 ? ( cpu_user + cpu_system ) * 1e6 / received_count : 0 ) << " us per event\n";
+	std::cout << "latency:         p50 " << latency.percentile( 0.5 ) / 1e3 << " us, p90 " << latency.percentile( 0.9 ) / 1e3
+		<< " us, p99 " << latency.percentile( 0.99 ) / 1e3 << " us, max " << latency.max() / 1e3 << " us\n";
+	
+	return received_count == count ? 0 : 1;
+}
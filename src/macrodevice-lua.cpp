@@ -24,10 +24,16 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <deque>
+#include <memory>
 #include <exception>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
 #include <cstdio>
+#include <cstdlib>
 
 #include <getopt.h> // getopt_long
 #include <sys/types.h> // for fork
@@ -47,6 +53,14 @@ extern "C"
 }
 
 #include "backends/helpers.h"
+#include "reactor.h"
+#include "channels.h"
+#include "event-queue.h"
+#include "bindings.h"
+#include "spawner.h"
+#include "histogram.h"
+#include "recorder.h"
+#include "hotplug.h"
 
 // version defined in makefile
 #ifndef VERSION_STRING
@@ -78,6 +92,18 @@ extern "C"
 #include "backends/macrodevice-xindicator.h"
 #endif
 
+#ifdef USE_BACKEND_SYNTHETIC
+#include "backends/macrodevice-synthetic.h"
+#endif
+
+#ifdef USE_BACKEND_REPLAY
+#include "backends/macrodevice-replay.h"
+#endif
+
+#ifdef USE_BACKEND_HIDRAW
+#include "backends/macrodevice-hidraw.h"
+#endif
+
 // help message
 //**********************************************************************
 const std::string help_message = R"(macrodevice-lua options:
@@ -94,18 +120,159 @@ Licensed under the GNU GPL v3 or later
 
 // global variables
 //**********************************************************************
-/// Threads for event handling, one thread per device
+/// Threads for event handling, one thread per device not handled by the reactor
 std::vector<std::jthread> device_threads;
 
-/// Used as an identifier for each thread
-int thread_number = 0;
+/// What happens when the event queue is full
+enum class overflow_policy
+{
+	block, ///< wait until there is space
+	drop_oldest, ///< remove the oldest event from the queue
+	coalesce ///< keep only the latest event of the device until there is space
+};
+
+/// State of an opened device
+struct device_state
+{
+	/// Used to request closing the device, its token is passed to the device thread
+	std::stop_source stop;
+	
+	/// Registry reference of the callback function in the main Lua state
+	int callback_ref = LUA_NOREF;
+	
+	/// Pass the events through the event queue to the dispatcher thread?
+	bool queued = false;
+	
+	/// Pass the fields of events as integers instead of strings?
+	bool integers = false;
+	
+	/// Overwrite the same event table for every event instead of creating a new one?
+	bool reuse_event_table = false;
+	
+	/// Registry reference of the reused event table, created by the first event in the Lua state that handles the device
+	int event_table_ref = LUA_NOREF;
+	
+	/// Registry reference of the reused frame table (batch = "frame"), kept apart from the event table because bound events are still passed individually
+	int frame_table_ref = LUA_NOREF;
+	
+	/// Registry reference of the table that maps the names of fields (as light userdata) to Lua strings, see push_name()
+	int name_table_ref = LUA_NOREF;
+	
+	/// Opened with isolated = true?
+	bool isolated = false;
+	
+	/// Bindings of the device, see lua_bind()
+	macrodevice::bindings bindings;
+	
+	/// Converts names in the patterns of bindings to values, NULL if the backend doesn't have names
+	int (*field_from_name)( unsigned int, const char*, const macrodevice::event&, long long& ) = NULL;
+	
+	/// The patterns of bindings are payloads instead of fields
+	bool payload_events = false;
+	
+	/// Durations in ns, see lua_stats(): from the timestamp of an event until the backend has returned it,
+	/// waiting for the Lua mutex (or the dispatcher thread), and running the Lua function
+	macrodevice::histogram read_latency, lock_wait, callback_duration;
+	
+	/// Number of received events, and of failed reads and Lua errors
+	std::atomic< uint64_t > events_received = 0, errors = 0;
+	
+	/// Used when the event queue is full
+	overflow_policy overflow = overflow_policy::block;
+	
+	/// Number of events passed to the dispatcher, dropped, and replaced by a newer event
+	std::atomic< uint64_t > events_queued = 0, events_dropped = 0, events_coalesced = 0;
+	
+	/// Number of queued events with a payload longer than MACRODEVICE_QUEUE_PAYLOAD_SIZE, which got truncated
+	std::atomic< uint64_t > events_truncated = 0;
+	
+	/// The latest event that didn't fit into the full event queue (coalesce policy), guarded by mutex_pending
+	macrodevice::queued_event pending;
+	bool has_pending = false;
+	std::mutex mutex_pending;
+	
+	/// Writes the received events to an event log, NULL without the record setting
+	std::unique_ptr< macrodevice::recorder > recorder;
+	
+	/// The id returned to Lua
+	int id = -1;
+	
+	/// Reopen the device after it has been lost, see macrodevice::hotplug
+	bool reconnect = false;
+	
+	/// Registry references of the on_connect and on_disconnect functions in the main Lua state
+	int connect_ref = LUA_NOREF, disconnect_ref = LUA_NOREF;
+};
+
+/// The on_connect and on_disconnect functions from the settings of a device, see lua_open_device()
+struct device_hooks
+{
+	int connect_ref = LUA_NOREF;
+	int disconnect_ref = LUA_NOREF;
+};
+
+/// All opened devices, the index is the id returned to Lua
+std::deque<device_state> devices;
+
+/// Handles all devices opened with reactor = true in a single thread
+macrodevice::reactor reactor;
+
+/// Reopens the devices opened with reconnect = true after they have been lost
+macrodevice::hotplug hotplug;
+
+/// Passes the events of all devices opened with queue = true to the dispatcher thread
+macrodevice::event_queue queue;
+
+/// Passes the events from the event queue to the main Lua state
+std::jthread dispatcher_thread;
+
+/// Number of devices with a pending event that didn't fit into the event queue
+std::atomic< int > pending_events = 0;
+
+/// Maximum number of events the dispatcher thread handles while holding mutex_lua
+#define DISPATCH_BATCH_SIZE 64
 
 /// Mutex for interactions with the Lua state
 std::mutex mutex_lua;
 
-/// This mutex gets lock when opening a new device
+/// This mutex gets locked when opening a new device, it also guards the size of devices, see find_device()
 std::mutex mutex_open_device;
 
+/// The ids returned by each call of macrodevice.open() in the main Lua state, -1 for failed calls
+std::vector<int> open_calls;
+
+/// Message channels shared by all Lua states
+macrodevice::channels channels;
+
+/// Starts the processes of macrodevice.spawn() and of bindings with a shell command
+macrodevice::spawner spawner;
+
+/// Path and language of the config file, used to create additional Lua states
+std::string config_path, config_language;
+
+/// Arguments passed to Lua
+std::vector< std::string > lua_args;
+
+/// Registry key of the reference to the callback in the Lua state of an isolated device
+#define DEVICE_CALLBACK_KEY "macrodevice_callback"
+
+/// Handler of an event that matched a binding with a Lua function, the binding is looked up again while the mutex of the Lua state is locked
+/// because macrodevice.bind() can replace it and release its registry reference before the event is delivered
+#define BINDING_HANDLER ( LUA_NOREF - 1 )
+
+/// Returns the device with the given id or NULL, for the Lua functions that take a device id
+/// The Lua states of isolated devices don't lock mutex_lua while the main Lua state adds devices, so mutex_open_device is locked,
+/// the returned device stays valid as devices only grows
+device_state *find_device( lua_Integer id )
+{
+	const std::lock_guard<std::mutex> lock( mutex_open_device );
+	
+	if( id < 0 || id >= (lua_Integer)devices.size() )
+		return NULL;
+	
+	return &devices[id];
+}
+
 /// Drop root permissions to the given user and group id
 int drop_root( uid_t uid, gid_t gid )
 {
@@ -139,99 +306,960 @@ int drop_root( uid_t uid, gid_t gid )
 
 // functions
 //**********************************************************************
-/// Thread function to open a specified device and pass the incoming events to the callback function
-template< class T > int run_macros( std::stop_token st, T device, lua_State *L, std::map<std::string, std::string> settings, std::string callback_registry_key )
+lua_State *new_device_lua_state( int open_call, int &callback_ref );
+
+/// Pushes the name of a field, names is the stack index of the name table of the device
+/// The names of the backends are static strings, so each one is created as a Lua string only once and then kept in the name table
+inline void push_name( lua_State *L, const char *name, int names )
 {
-	// pass settings to the device object
-	//******************************************************************
-	if( device.load_settings( settings ) != 0 ){
-		std::cerr << "Error: Invalid settings specified\n";
-		return 1;
-	}
+	if( lua_rawgetp( L, names, name ) == LUA_TSTRING )
+		return;
 	
-	// open the device
-	//******************************************************************
-	if( device.open_device() != 0 ){
-		std::cerr << "Error: Could not open the device\n";
-		return 1;
+	lua_pop( L, 1 );
+	lua_pushstring( L, name );
+	lua_pushvalue( L, -1 );
+	lua_rawsetp( L, names, name );
+}
+
+/// Sets the fields of the event table at the top of the stack, as strings, or as integers if integers is true
+/// Fields with a name are passed as the name in string mode (names is the stack index of the name table), remaining fields of a reused table are removed
+void fill_event_table( lua_State *L, const macrodevice::event &event, bool integers, bool reused, int names )
+{
+	unsigned int size = event.payload ? 1 : event.size;
+	
+	if( event.payload )
+	{
+		lua_pushlstring( L, event.payload, event.payload_size );
+		lua_rawseti( L, -2, 1 );
+	}
+	else
+	{
+		for( unsigned int i = 0; i < event.size; i++ ){
+			if( integers )
+			{
+				lua_pushinteger( L, event.value[i] );
+			}
+			else if( event.name[i] )
+			{
+				push_name( L, event.name[i], names );
+			}
+			else
+			{
+				// format the number on the stack, to avoid a std::string
+				char buffer[24];
+				int length = snprintf( buffer, sizeof(buffer), "%lld", event.value[i] );
+				lua_pushlstring( L, buffer, length );
+			}
+			lua_rawseti( L, -2, i+1 ); // set table value
+		}
 	}
 	
-	// wait for input
-	//******************************************************************
-	std::vector< std::string > event;
-	std::string lua_return;
+	if( reused )
+	{
+		for( unsigned int i = size+1; i <= MACRODEVICE_EVENT_SIZE; i++ ){
+			lua_pushnil( L );
+			lua_rawseti( L, -2, i );
+		}
+	}
+}
 
-	while( !st.stop_requested() )
+/// Sets the events of the frame table at the top of the stack, the event tables of a reused frame table are reused as well
+void fill_event_table( lua_State *L, const std::vector< macrodevice::event > &frame, bool integers, bool reused, int names )
+{
+	for( unsigned int i = 0; i < frame.size(); i++ ){
+		bool reused_event = false;
+		
+		if( reused )
+		{
+			lua_rawgeti( L, -1, i+1 );
+			reused_event = lua_istable( L, -1 );
+			if( !reused_event )
+				lua_pop( L, 1 );
+		}
+		if( !reused_event )
+			lua_createtable( L, MACRODEVICE_EVENT_SIZE, 0 );
+		
+		fill_event_table( L, frame[i], integers, reused_event, names );
+		lua_rawseti( L, -2, i+1 );
+	}
+	
+	// remove the events of a previous, larger frame
+	if( reused )
 	{
-		int status = device.wait_for_event( event );
+		for( unsigned int i = frame.size()+1; ; i++ ){
+			lua_rawgeti( L, -1, i );
+			bool end = lua_isnil( L, -1 );
+			lua_pop( L, 1 );
+			if( end )
+				break;
+			
+			lua_pushnil( L );
+			lua_rawseti( L, -2, i );
+		}
+	}
+}
 
-		if( status == MACRODEVICE_FAILURE )
+/// Pushes the table for an event (or a frame of events) onto the Lua stack, a new one or the reused table of the device
+template< class E > void push_event( lua_State *L, const E &event, device_state &state )
+{
+	// the name table, created by the first event in the Lua state that handles the device
+	int names = 0;
+	if( !state.integers )
+	{
+		if( state.name_table_ref == LUA_NOREF )
 		{
-			std::cerr << "Warning : could not get input event\n";
-			continue;
+			lua_newtable( L );
+			lua_pushvalue( L, -1 );
+			state.name_table_ref = luaL_ref( L, LUA_REGISTRYINDEX );
 		}
-		else if( status == MACRODEVICE_TIMEOUT )
+		else
 		{
-			continue;
+			lua_rawgeti( L, LUA_REGISTRYINDEX, state.name_table_ref );
 		}
-		else if( status == MACRODEVICE_SUCCESS )
+		names = lua_gettop( L );
+	}
+	
+	// frames and single events don't share a table, their layouts differ
+	int &table_ref = std::is_same_v< E, macrodevice::event > ? state.event_table_ref : state.frame_table_ref;
+	
+	if( state.reuse_event_table && table_ref != LUA_NOREF )
+	{
+		lua_rawgeti( L, LUA_REGISTRYINDEX, table_ref );
+		fill_event_table( L, event, state.integers, true, names );
+	}
+	else
+	{
+		lua_createtable( L, MACRODEVICE_EVENT_SIZE, 0 ); // create new table at the top of the stack
+		fill_event_table( L, event, state.integers, false, names );
+		
+		// keep the table for the next event
+		if( state.reuse_event_table )
 		{
-			// process input event
-			//******************************************************************
+			lua_pushvalue( L, -1 );
+			table_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+		}
+	}
+	
+	// only leave the event table on the stack
+	if( names )
+		lua_remove( L, names );
+}
+
+/// Passes an event (or a frame of events) to the Lua callback function, returns false if the device should be closed
+/// The mutex of the Lua state must be locked
+template< class E > bool call_callback( lua_State *L, int callback_ref, const E &event, device_state &state )
+{
+	if constexpr( std::is_same_v< E, macrodevice::event > )
+	{
+		if( callback_ref == BINDING_HANDLER )
+		{
+			// the registry reference of the binding is valid while the mutex is locked
+			macrodevice::binding binding;
+			if( !state.bindings.find( event, binding ) )
+				return true;
 			
-			// lock lua mutex
+			// the binding has been replaced by a command after the event was matched
+			if( !binding.command.empty() )
+			{
+				spawner.spawn( { "/bin/sh", "-c", binding.command }, {} );
+				return true;
+			}
+			
+			callback_ref = binding.function;
+		}
+	}
+	
+	// load callback function onto the stack
+	lua_rawgeti( L, LUA_REGISTRYINDEX, callback_ref );
+	
+	push_event( L, event, state );
+	
+	// call lua callback function
+	if( lua_pcall( L, 1, 1, 0 ) != 0 ){
+		std::cerr << "An error occured: " << lua_tostring( L, -1 ) << "\n";
+		lua_remove( L, -1 );  // remove top value from stack
+		state.errors++;
+		return false;
+	}
+	
+	// get return value from lua callback function, quit if requested by lua
+	bool quit = lua_isstring( L, -1 ) && std::string( lua_tostring( L, -1 ) ) == "quit";
+	
+	// remove function return value from stack
+	lua_remove( L, -1 );
+	
+	return !quit;
+}
+
+/// Calls the on_connect or on_disconnect function of a device with the id of the device
+/// L is the main Lua state, mutex_lua must not be locked
+void call_hook( lua_State *L, int ref, const device_state &state )
+{
+	if( ref == LUA_NOREF )
+		return;
+	
+	const std::lock_guard<std::mutex> lock( mutex_lua );
+	
+	lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+	lua_pushinteger( L, state.id );
+	
+	if( lua_pcall( L, 1, 0, 0 ) != 0 ){
+		std::cerr << "An error occured: " << lua_tostring( L, -1 ) << "\n";
+		lua_remove( L, -1 );  // remove top value from stack
+	}
+}
+
+/// Passes an event of a device with queue = true to the dispatcher thread, applies the overflow policy if the queue is full
+/// handler is the registry reference of the function that gets called with the event, or BINDING_HANDLER
+void queue_event( device_state &state, const macrodevice::event &event, int handler, std::stop_token st )
+{
+	macrodevice::queued_event record;
+	if( !macrodevice::pack_event( &state, event, record ) && state.events_truncated++ == 0 )
+		std::cerr << "Warning: device " << state.id << " has events with a payload longer than " << MACRODEVICE_QUEUE_PAYLOAD_SIZE << " bytes, they get truncated because of queue = true\n";
+	record.handler = handler;
+	
+	if( state.overflow == overflow_policy::coalesce )
+	{
+		const std::lock_guard<std::mutex> lock( state.mutex_pending );
+		
+		// queue the pending event first, to keep the order of events
+		if( state.has_pending && queue.push( state.pending ) )
+		{
+			state.has_pending = false;
+			pending_events--;
+			state.events_queued++;
+		}
+		
+		if( !state.has_pending && queue.push( record ) )
+		{
+			state.events_queued++;
+			return;
+		}
+		
+		// the queue is full, replace the pending event
+		if( state.has_pending )
+		{
+			state.events_coalesced++;
+		}
+		else
+		{
+			state.has_pending = true;
+			pending_events++;
+		}
+		state.pending = record;
+		
+		return;
+	}
+	
+	while( !queue.push( record ) )
+	{
+		if( state.overflow == overflow_policy::drop_oldest )
+		{
+			// make space by dropping the oldest event, which may belong to any device
+			macrodevice::queued_event oldest;
+			if( queue.pop( oldest ) )
+				static_cast< device_state* >( oldest.device )->events_dropped++;
+		}
+		else
+		{
+			// block until the dispatcher has made space
+			if( st.stop_requested() )
+			{
+				state.events_dropped++;
+				return;
+			}
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+		}
+	}
+	
+	state.events_queued++;
+}
+
+/// Passes a queued event to the Lua callback of its device, mutex_lua must be locked
+void dispatch_event( lua_State *L, const macrodevice::queued_event &record, macrodevice::event &event )
+{
+	device_state *state = static_cast< device_state* >( record.device );
+	
+	// the device has been closed, drop the remaining events
+	if( state->stop.stop_requested() )
+		return;
+	
+	macrodevice::unpack_event( record, event );
+	
+	// the time spent in the event queue counts as waiting for the lock
+	uint64_t start = macrodevice::monotonic_ns();
+	state->lock_wait.record( start - std::min( start, event.timestamp ) );
+	
+	bool keep_open = call_callback( L, record.handler, event, *state );
+	state->callback_duration.record( macrodevice::monotonic_ns() - start );
+	
+	// close the device if requested by lua or on error
+	if( !keep_open )
+	{
+		state->stop.request_stop();
+		reactor.wake();
+	}
+}
+
+/// Thread function that passes the events from the event queue to the Lua callback functions
+void run_dispatcher( std::stop_token st, lua_State *L )
+{
+	macrodevice::queued_event record;
+	macrodevice::event event;
+	
+	while( true )
+	{
+		uint32_t token = queue.wait_token();
+		bool dispatched = false;
+		
+		{
+			// lock lua mutex once for multiple events
 			const std::lock_guard<std::mutex> lock( mutex_lua );
 			
-			// load callback function onto the stack
-			lua_pushstring( L, callback_registry_key.c_str() ); // push key onto the stack
-			lua_gettable( L, LUA_REGISTRYINDEX ); // push registry["callback_registry_key"] onto the stack
+			for( int i = 0; i < DISPATCH_BATCH_SIZE && queue.pop( record ); i++ )
+			{
+				dispatch_event( L, record, event );
+				dispatched = true;
+			}
 			
-			lua_newtable( L ); // create new table at the top of the stack
-			for( unsigned int i = 0; i < event.size(); i++ ){
-				lua_pushnumber( L, i+1 ); // push table index
-				lua_pushstring( L, event.at(i).c_str() ); // push table value
-				lua_settable( L, -3 );
+			// the queue is empty, handle the events that didn't fit into it
+			if( !dispatched && pending_events > 0 )
+			{
+				for( auto &d : devices )
+				{
+					bool has_pending = false;
+					{
+						const std::lock_guard<std::mutex> lock_pending( d.mutex_pending );
+						if( d.has_pending )
+						{
+							record = d.pending;
+							has_pending = true;
+							d.has_pending = false;
+							pending_events--;
+							d.events_queued++;
+						}
+					}
+					
+					if( has_pending )
+					{
+						dispatch_event( L, record, event );
+						dispatched = true;
+					}
+				}
 			}
+		}
+		
+		// wait for new events, quit once all events have been handled
+		if( !dispatched )
+		{
+			if( st.stop_requested() )
+				return;
 			
-			// call lua callback function
-			if( lua_pcall( L, 1, 1, 0 ) != 0 ){
-				std::cerr << "An error occured: " << lua_tostring( L, -1 ) << "\n";
-				lua_remove( L, -1 );  // remove top value from stack
-				device.close_device();
-				return 1;
+			queue.wait( token );
+		}
+	}
+}
+
+/// Reads the events of an opened device and passes them to the Lua callback function or the event queue
+/// Used by the device threads and the reactor
+template< class T > class device_session
+{
+	public:
+		
+		/// Result of step()
+		enum class result
+		{
+			handled, ///< an event has been handled
+			timeout, ///< no event was available
+			failure, ///< the backend couldn't get an event
+			close ///< the device should be closed, requested by Lua or because of an error
+		};
+		
+		T device;
+		
+		/// Lua state and its mutex
+		lua_State *L = NULL;
+		std::mutex *mutex = &mutex_lua;
+		int callback_ref = LUA_NOREF;
+		
+		device_state *state = NULL;
+		
+		/// pass all events up to a SYN_REPORT to Lua at once?
+		bool batch = false;
+		
+		/// the device is being closed because Lua or an error requested it, not because it has been lost (reactor)
+		bool closing = false;
+		
+		/**
+		 * Passes the settings to the device and opens it
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int open( const std::map< std::string, std::string > &settings )
+		{
+			// pass settings to the device object
+			//**********************************************************
+			if( device.load_settings( settings ) != 0 ){
+				std::cerr << "Error: Invalid settings specified\n";
+				return MACRODEVICE_FAILURE;
 			}
 			
-			// get return value from lua callback function
-			if( lua_isstring( L, -1 ) )
+			if( settings.contains( "batch" ) && settings.at( "batch" ) == "frame" )
+			{
+				if constexpr( requires( T d, std::vector< macrodevice::event > &frame ){ d.wait_for_frame( frame ); } )
+				{
+					batch = true;
+					
+					if( state->queued )
+						std::cerr << "Warning: Queued devices pass the events of a frame individually\n";
+				}
+				else
+				{
+					std::cerr << "Error: The backend doesn't support batch = \"frame\"\n";
+					return MACRODEVICE_FAILURE;
+				}
+			}
+			
+			// open the device
+			//**********************************************************
+			if( device.open_device() != 0 ){
+				std::cerr << "Error: Could not open the device\n";
+				return MACRODEVICE_FAILURE;
+			}
+			
+			return MACRODEVICE_SUCCESS;
+		}
+		
+		/**
+		 * Waits for a single event or frame and passes it on
+		 * @param st Stop token, used when waiting for space in the event queue
+		 */
+		result step( std::stop_token st )
+		{
+			int status;
+			
+			if constexpr( requires( T d, std::vector< macrodevice::event > &frame ){ d.wait_for_frame( frame ); } )
 			{
-				lua_return = lua_tostring( L, -1 );
+				status = batch ? device.wait_for_frame( m_frame ) : device.wait_for_event( m_event );
+			}
+			else
+			{
+				status = device.wait_for_event( m_event );
+			}
+			
+			if( status == MACRODEVICE_FAILURE )
+			{
+				state->errors++;
+				return result::failure;
+			}
+			else if( status == MACRODEVICE_TIMEOUT )
+			{
+				return result::timeout;
+			}
+			
+			// time from the source of the event until it has been read
+			uint64_t now = macrodevice::monotonic_ns();
+			if( batch )
+			{
+				for( auto &e : m_frame )
+					state->read_latency.record( now - std::min( now, e.timestamp ) );
+				state->events_received += m_frame.size();
+			}
+			else
+			{
+				state->read_latency.record( now - std::min( now, m_event.timestamp ) );
+				state->events_received++;
+			}
+			
+			// the recorder only encodes the events, they get written by its own thread
+			if( state->recorder )
+			{
+				if( batch )
+				{
+					for( auto &e : m_frame )
+						state->recorder->record( e );
+				}
+				else
+				{
+					state->recorder->record( m_event );
+				}
+			}
+			
+			bool keep_open = true;
+			
+			if( batch )
+			{
+				// events with a binding are handled individually, the remaining events are passed to the callback as a frame
+				if( !state->bindings.empty() )
+				{
+					std::erase_if( m_frame, [&]( const macrodevice::event &e )
+					{
+						int handler;
+						if( !find_binding( e, handler ) )
+							return false;
+						
+						if( handler != LUA_NOREF )
+							keep_open = deliver( handler, e, st ) && keep_open;
+						return true;
+					} );
+				}
 				
-				//quit if requested by lua
-				if( lua_return == "quit" )
+				if( !m_frame.empty() && has_callback() )
+					keep_open = deliver( callback_ref, m_frame, st ) && keep_open;
+			}
+			else
+			{
+				// events without a binding go to the callback, or get dropped if there is none
+				int handler;
+				if( !find_binding( m_event, handler ) )
+					handler = has_callback() ? callback_ref : LUA_NOREF;
+				
+				if( handler != LUA_NOREF )
+					keep_open = deliver( handler, m_event, st );
+			}
+			
+			return keep_open ? result::handled : result::close;
+		}
+		
+	private:
+		
+		/// Has the device been opened with a callback function?
+		bool has_callback() const
+		{
+			return callback_ref != LUA_NOREF && callback_ref != LUA_REFNIL;
+		}
+		
+		/**
+		 * Looks up the binding of an event, commands are run directly without Lua
+		 * @param handler BINDING_HANDLER for a binding with a Lua function, LUA_NOREF if nothing is left to do
+		 * @return true if the event has a binding
+		 */
+		bool find_binding( const macrodevice::event &event, int &handler )
+		{
+			if( state->bindings.empty() || !state->bindings.find( event, m_binding ) )
+				return false;
+			
+			if( !m_binding.command.empty() )
+			{
+				spawner.spawn( { "/bin/sh", "-c", m_binding.command }, {} );
+				handler = LUA_NOREF;
+			}
+			else
+			{
+				handler = BINDING_HANDLER;
+			}
+			
+			return true;
+		}
+		
+		/**
+		 * Passes an event (or a frame of events) to a Lua function, or to the dispatcher thread for devices with queue = true
+		 * @return false if the device should be closed
+		 */
+		template< class E > bool deliver( int handler, const E &event, std::stop_token st )
+		{
+			if( state->queued )
+			{
+				// pass input event to the dispatcher thread
+				if constexpr( std::is_same_v< E, std::vector< macrodevice::event > > )
 				{
-					break;
+					for( auto &e : event )
+						queue_event( *state, e, handler, st );
+				}
+				else
+				{
+					queue_event( *state, event, handler, st );
 				}
 				
+				return true;
 			}
 			
-			// remove function return value from stack
-			lua_remove( L, -1 );
+			// lock lua mutex
+			uint64_t start = macrodevice::monotonic_ns();
+			const std::lock_guard<std::mutex> lock( *mutex );
+			uint64_t locked = macrodevice::monotonic_ns();
+			state->lock_wait.record( locked - start );
+			
+			// process input event, quit if requested by lua or on error
+			bool keep_open = call_callback( L, handler, event, *state );
+			state->callback_duration.record( macrodevice::monotonic_ns() - locked );
+			
+			return keep_open;
 		}
 		
+		/// the binding found by find_binding, reused to avoid allocations
+		macrodevice::binding m_binding;
+		
+		/// the last event or frame, reused to avoid allocations
+		macrodevice::event m_event;
+		std::vector< macrodevice::event > m_frame;
+};
+
+/// Thread function to open a specified device and pass the incoming events to the callback function
+/// If open_call is not -1, the callback runs in a new Lua state, see new_device_lua_state()
+template< class T > int run_macros( std::stop_token st, T device, lua_State *L, std::map<std::string, std::string> settings, int open_call, device_state *state )
+{
+	device_session< T > session;
+	session.device = std::move( device );
+	session.L = L;
+	session.callback_ref = state->callback_ref;
+	session.state = state;
+	
+	// create the Lua state of an isolated device
+	//******************************************************************
+	std::unique_ptr< lua_State, decltype( &lua_close ) > device_L( NULL, lua_close );
+	std::mutex mutex_device_lua;
+	
+	if( open_call >= 0 )
+	{
+		device_L.reset( new_device_lua_state( open_call, session.callback_ref ) );
+		if( !device_L ){
+			std::cerr << "Error: Could not create the Lua state of the device\n";
+			return 1;
+		}
+		
+		session.L = device_L.get();
+		session.mutex = &mutex_device_lua;
+	}
+	
+	// open the device
+	//******************************************************************
+	if( session.open( settings ) != MACRODEVICE_SUCCESS ){
+		return 1;
+	}
+	
+	// wait for input
+	//******************************************************************
+	bool opened = true;
+	while( !st.stop_requested() )
+	{
+		bool lost = false;
+		{
+			// backends that wait without a timeout get woken up when the device should be closed
+			std::stop_callback wake( st, [&session]()
+			{
+				if constexpr( requires( T d ){ d.interrupt(); } )
+					session.device.interrupt();
+			} );
+			
+			while( !st.stop_requested() )
+			{
+				auto result = session.step( st );
+				
+				if( result == device_session< T >::result::failure )
+				{
+					if( state->reconnect )
+					{
+						lost = true;
+						break;
+					}
+					std::cerr << "Warning : could not get input event\n";
+				}
+				else if( result == device_session< T >::result::close )
+				{
+					break;
+				}
+			}
+		}
+		
+		if( !lost )
+			break;
+		
+		// reopen the device once it is available again, the hooks run in the main Lua state
+		//**************************************************************
+		std::cerr << "Warning: Lost the device, waiting until it can be reopened\n";
+		session.device.close_device();
+		call_hook( L, state->disconnect_ref, *state );
+		
+		opened = hotplug.reconnect( [&session](){ return session.device.open_device() == MACRODEVICE_SUCCESS; }, st );
+		if( !opened )
+			break;
+		
+		call_hook( L, state->connect_ref, *state );
 	}
 	
 	// close the device
 	//******************************************************************
-	device.close_device();
+	if( opened )
+		session.device.close_device();
+	
+	if( state->recorder )
+		state->recorder->close();
 	
 	return 0;
 }
 
+/// Adds an opened device to the reactor, or hands it to the hotplug supervisor once it has been lost
+/// @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE, the device stays open in case of failure
+template< class T > int add_to_reactor( std::shared_ptr< device_session< T > > session )
+{
+	std::vector< struct pollfd > fds;
+	if( session->device.get_pollfds( fds ) != MACRODEVICE_SUCCESS ){
+		std::cerr << "Error: Could not get the file descriptors of the device\n";
+		return MACRODEVICE_FAILURE;
+	}
+	
+	auto service = [session]() -> bool
+	{
+		// handle all pending events
+		while( true )
+		{
+			auto result = session->step( session->state->stop.get_token() );
+			
+			if( result == device_session< T >::result::failure )
+			{
+				// a lost device gets reopened after it has been removed from the reactor
+				if( session->state->reconnect )
+					return false;
+				
+				std::cerr << "Warning : could not get input event\n";
+				return true;
+			}
+			else if( result == device_session< T >::result::timeout )
+			{
+				return true;
+			}
+			else if( result == device_session< T >::result::close )
+			{
+				session->closing = true;
+				return false;
+			}
+		}
+	};
+	
+	auto close = [session]()
+	{
+		session->device.close_device();
+		
+		device_state *state = session->state;
+		
+		// the device has been lost (a failed read or a hangup), reopen it once it is available again
+		if( state->reconnect && !session->closing && !state->stop.stop_requested() )
+		{
+			std::cerr << "Warning: Lost the device, waiting until it can be reopened\n";
+			call_hook( session->L, state->disconnect_ref, *state );
+			
+			auto reopen = [session]() -> bool
+			{
+				if( session->device.open_device() != MACRODEVICE_SUCCESS )
+					return false;
+				
+				call_hook( session->L, session->state->connect_ref, *session->state );
+				
+				if( add_to_reactor( session ) != MACRODEVICE_SUCCESS )
+				{
+					session->device.close_device();
+					call_hook( session->L, session->state->disconnect_ref, *session->state );
+					return false;
+				}
+				
+				return true;
+			};
+			
+			auto cancel = [session]()
+			{
+				if( session->state->recorder )
+					session->state->recorder->close();
+			};
+			
+			if( hotplug.add_watch( reopen, cancel, state->stop.get_token() ) == MACRODEVICE_SUCCESS )
+				return;
+			
+			std::cerr << "Error: Could not watch for the device\n";
+		}
+		
+		if( state->recorder )
+			state->recorder->close();
+	};
+	
+	if( reactor.add_source( fds, service, close, session->state->stop.get_token() ) != MACRODEVICE_SUCCESS ){
+		std::cerr << "Error: Could not add the device to the reactor\n";
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/// Opens a device and adds it to the reactor
+/// @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+template< class T > int run_macros_reactor( lua_State *L, std::map<std::string, std::string> settings, device_state *state )
+{
+	auto session = std::make_shared< device_session< T > >();
+	session->L = L;
+	session->callback_ref = state->callback_ref;
+	session->state = state;
+	
+	// the reactor waits for input, the device only reads pending events
+	settings.insert_or_assign( "timeout", "0" );
+	
+	// open the device
+	//******************************************************************
+	if( session->open( settings ) != MACRODEVICE_SUCCESS ){
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// add device to the reactor
+	//******************************************************************
+	if( add_to_reactor( session ) != MACRODEVICE_SUCCESS ){
+		session->device.close_device();
+		return MACRODEVICE_FAILURE;
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/// Starts handling the events of a device, in a new thread or with the reactor, returns the device id or -1 in case of failure
+template< class T > int start_device( lua_State *L, std::map<std::string, std::string> settings, int callback_ref, device_hooks hooks )
+{
+	bool use_reactor = settings.contains( "reactor" ) && macrodevice::string_to_bool( settings.at( "reactor" ), false );
+	bool isolated = settings.contains( "isolated" ) && macrodevice::string_to_bool( settings.at( "isolated" ), false );
+	
+	devices.emplace_back();
+	device_state &state = devices.back();
+	state.callback_ref = callback_ref;
+	state.queued = settings.contains( "queue" ) && macrodevice::string_to_bool( settings.at( "queue" ), false );
+	state.integers = settings.contains( "integers" ) && macrodevice::string_to_bool( settings.at( "integers" ), false );
+	state.reuse_event_table = settings.contains( "reuse_event_table" ) && macrodevice::string_to_bool( settings.at( "reuse_event_table" ), false );
+	state.isolated = isolated;
+	state.id = devices.size()-1;
+	
+	// reopen the device after it has been lost
+	state.reconnect = settings.contains( "reconnect" ) && macrodevice::string_to_bool( settings.at( "reconnect" ), false );
+	state.connect_ref = hooks.connect_ref;
+	state.disconnect_ref = hooks.disconnect_ref;
+	
+	// how the patterns of bindings are parsed
+	if constexpr( requires( const char *name, const macrodevice::event &pattern, long long &value ){ T::field_from_name( 0, name, pattern, value ); } )
+		state.field_from_name = T::field_from_name;
+	if constexpr( requires{ T::payload_events; } )
+		state.payload_events = T::payload_events;
+	
+	// event queue settings
+	if( settings.contains( "overflow" ) )
+	{
+		if( settings.at( "overflow" ) == "block" )
+			state.overflow = overflow_policy::block;
+		else if( settings.at( "overflow" ) == "drop_oldest" )
+			state.overflow = overflow_policy::drop_oldest;
+		else if( settings.at( "overflow" ) == "coalesce" )
+			state.overflow = overflow_policy::coalesce;
+		else
+		{
+			std::cerr << "Error: Invalid overflow policy\n";
+			devices.pop_back();
+			return -1;
+		}
+	}
+	
+	// write the events to an event log
+	if( settings.contains( "record" ) )
+	{
+		state.recorder = std::make_unique< macrodevice::recorder >();
+		if( state.recorder->open( settings.at( "record" ) ) != MACRODEVICE_SUCCESS )
+		{
+			std::cerr << "Error: Could not open the record file\n";
+			devices.pop_back();
+			return -1;
+		}
+	}
+	
+	if( state.queued && isolated )
+	{
+		std::cerr << "Warning: Isolated devices can't use the event queue\n";
+		state.queued = false;
+	}
+	
+	if( state.queued && !dispatcher_thread.joinable() )
+	{
+		dispatcher_thread = std::jthread( run_dispatcher, L );
+	}
+	
+	// the Lua state of an isolated device is created by the thread of the device
+	if( isolated )
+	{
+		if( use_reactor )
+			std::cerr << "Warning: Isolated devices can't use the reactor, using a separate thread\n";
+		
+		device_threads.push_back( std::jthread( run_macros<T>, state.stop.get_token(), T(), L, settings, open_calls.size(), &state ) );
+		
+		return devices.size()-1;
+	}
+	else if( use_reactor )
+	{
+		// only backends with pollable file descriptors can be handled by the reactor
+		if constexpr( requires( T device, std::vector< struct pollfd > &fds ){ device.get_pollfds( fds ); } )
+		{
+			if( run_macros_reactor< T >( L, settings, &state ) != MACRODEVICE_SUCCESS )
+			{
+				devices.pop_back();
+				return -1;
+			}
+			
+			return devices.size()-1;
+		}
+		else
+		{
+			std::cerr << "Warning: The backend doesn't support the reactor, using a separate thread\n";
+		}
+	}
+	
+	// the thread uses the stop source of the device, which exists before the thread starts
+	device_threads.push_back( std::jthread( run_macros<T>, state.stop.get_token(), T(), L, settings, -1, &state ) );
+	
+	return devices.size()-1;
+}
+
+/// Returns true if L is the Lua state of an isolated device
+bool is_device_lua_state( lua_State *L )
+{
+	lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_open_call" );
+	bool device_state = !lua_isnil( L, -1 );
+	lua_pop( L, 1 );
+	
+	return device_state;
+}
+
+/// Returns true while the config file is loaded again in the Lua state of an isolated device
+/// The main Lua state has already run the top level code, so functions with side effects outside of the Lua state do nothing
+bool is_loading_device_lua_state( lua_State *L )
+{
+	lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_loading" );
+	bool loading = lua_toboolean( L, -1 );
+	lua_pop( L, 1 );
+	
+	return loading;
+}
+
+/// Returns the id returned by the macrodevice.open() call with the given number in the main Lua state, or -1
+/// Only for the Lua states of isolated devices, which have a copy of open_calls
+int open_call_id( lua_State *L, int open_call )
+{
+	lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_open_ids" );
+	lua_rawgeti( L, -1, open_call+1 );
+	int id = lua_isinteger( L, -1 ) ? lua_tointeger( L, -1 ) : -1;
+	lua_pop( L, 2 );
+	
+	return id;
+}
+
+/// Pushes the id returned by start_device() onto the Lua stack, or nil in case of failure
+void push_device_id( lua_State *L, int id )
+{
+	if( id < 0 )
+		lua_pushnil( L );
+	else
+		lua_pushinteger( L, id );
+}
+
 /// Lua wrapper for drop_root()
 int lua_drop_root( lua_State *L )
 {
 	
-	if( lua_gettop( L ) == 2 ) // if two arguments passed: drop_root( uid, gid )
+	// root permissions have already been handled by the main Lua state
+	if( is_device_lua_state( L ) )
+	{
+		lua_pushinteger( L, 0 );
+	}
+	else if( lua_gettop( L ) == 2 ) // if two arguments passed: drop_root( uid, gid )
 	{
 		uid_t uid = luaL_checkinteger( L, 1 );
 		gid_t gid = luaL_checkinteger( L, 2 );
@@ -251,15 +1279,44 @@ int lua_drop_root( lua_State *L )
 	return 1;
 }
 
+/// macrodevice.open() in the Lua state of an isolated device, stores the callback if the call belongs to the device
+/// Returns the same id as the corresponding call in the main Lua state, no device gets opened
+int replay_open_device( lua_State *L )
+{
+	lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_open_call" );
+	int open_call = lua_tointeger( L, -1 );
+	lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_open_count" );
+	int open_count = lua_tointeger( L, -1 );
+	lua_pop( L, 2 );
+	
+	// count the calls of macrodevice.open()
+	lua_pushinteger( L, open_count+1 );
+	lua_setfield( L, LUA_REGISTRYINDEX, "macrodevice_open_count" );
+	
+	// store the callback (at the top of the stack) of this device
+	if( open_count == open_call )
+	{
+		lua_pushvalue( L, -1 );
+		lua_pushinteger( L, luaL_ref( L, LUA_REGISTRYINDEX ) );
+		lua_setfield( L, LUA_REGISTRYINDEX, DEVICE_CALLBACK_KEY );
+	}
+	
+	push_device_id( L, open_call_id( L, open_count ) );
+	return 1;
+}
+
 /// Lua function to open a new device, creates a new thread running run_macros()
 int lua_open_device( lua_State *L )
 {
 	// lock mutex, mutex_lua should be locked every time this function gets called
 	const std::lock_guard<std::mutex> lock( mutex_open_device );
 	
-	std::string backend, registry_key;
+	std::string backend;
+	int callback_ref;
 	std::map< std::string, std::string > settings;
+	device_hooks hooks;
 	bool backend_from_settings = false;
+	int id = -1;
 	
 	// check arguments
 	//******************************************************************
@@ -275,6 +1332,12 @@ int lua_open_device( lua_State *L )
 		luaL_checktype( L, 1, LUA_TTABLE );
 		// position 2 in the stack could be a function or a callable table, therefore it doesn't get checked
 	}
+	else if( lua_gettop( L ) == 1 ) // open( {settings} ), for devices that only use bindings
+	{
+		backend_from_settings = true;
+		luaL_checktype( L, 1, LUA_TTABLE );
+		lua_pushnil( L ); // no event handler
+	}
 	else
 	{
 		std::cerr << "Error: Invalid number of arguments to macrodevice.open()\n";
@@ -282,15 +1345,16 @@ int lua_open_device( lua_State *L )
 		return 1;
 	}
 
+	// the Lua state of an isolated device doesn't open devices
+	//******************************************************************
+	if( is_device_lua_state( L ) )
+	{
+		return replay_open_device( L );
+	}
+
 	// store callback function in Lua registry
 	//******************************************************************
-	registry_key = "macrodevice_callback_" + std::to_string( thread_number );
-	thread_number++;
-	
-	lua_pushstring( L, registry_key.c_str() ); // push key onto the stack
-	lua_pushvalue( L, -2 ); // push copy of the callback function onto the stack
-	lua_settable( L, LUA_REGISTRYINDEX ); // set registry[key] = callback function
-	lua_pop( L, 1 ); // pop callback function from the stack
+	callback_ref = luaL_ref( L, LUA_REGISTRYINDEX ); // pops the callback function from the stack
 	
 	// parse settings table
 	//******************************************************************
@@ -322,6 +1386,16 @@ int lua_open_device( lua_State *L )
 				// add key-value-pair to std::map
 				settings.emplace( lua_tostring( L, -2 ), lua_tostring( L, -1 ) );
 			}
+			else if( lua_type( L, -1 ) == LUA_TFUNCTION ) // functions called when the device has been lost or reopened
+			{
+				std::string key = lua_tostring( L, -2 );
+				
+				if( key == "on_connect" || key == "on_disconnect" )
+				{
+					lua_pushvalue( L, -1 );
+					( key == "on_connect" ? hooks.connect_ref : hooks.disconnect_ref ) = luaL_ref( L, LUA_REGISTRYINDEX );
+				}
+			}
 		}
 		
 		lua_remove( L, -1 ); // remove value from stack
@@ -337,8 +1411,7 @@ int lua_open_device( lua_State *L )
 	if( backend == "hidapi" )
 	{
 		#ifdef USE_BACKEND_HIDAPI
-		device_threads.push_back( std::jthread( run_macros<macrodevice::device_hidapi>, macrodevice::device_hidapi(), L, settings, registry_key ) );
-		lua_pushinteger( L, device_threads.size()-1 );
+		id = start_device<macrodevice::device_hidapi>( L, settings, callback_ref, hooks );
 		#else
 		std::cerr << "Error: Backend " << backend << " is not enabled\n";
 		#endif
@@ -346,8 +1419,7 @@ int lua_open_device( lua_State *L )
 	else if( backend == "libevdev" )
 	{
 		#ifdef USE_BACKEND_LIBEVDEV
-		device_threads.push_back( std::jthread( run_macros<macrodevice::device_libevdev>, macrodevice::device_libevdev(), L, settings, registry_key ) );
-		lua_pushinteger( L, device_threads.size()-1 );
+		id = start_device<macrodevice::device_libevdev>( L, settings, callback_ref, hooks );
 		#else
 		std::cerr << "Error: Backend " << backend << " is not enabled\n";
 		#endif
@@ -355,8 +1427,7 @@ int lua_open_device( lua_State *L )
 	else if( backend == "libusb" )
 	{
 		#ifdef USE_BACKEND_LIBUSB
-		device_threads.push_back( std::jthread( run_macros<macrodevice::device_libusb>, macrodevice::device_libusb(), L, settings, registry_key ) );
-		lua_pushinteger( L, device_threads.size()-1 );
+		id = start_device<macrodevice::device_libusb>( L, settings, callback_ref, hooks );
 		#else
 		std::cerr << "Error: Backend " << backend << " is not enabled\n";
 		#endif
@@ -364,8 +1435,7 @@ int lua_open_device( lua_State *L )
 	else if( backend == "serial" )
 	{
 		#ifdef USE_BACKEND_SERIAL
-		device_threads.push_back( std::jthread( run_macros<macrodevice::device_serial>, macrodevice::device_serial(), L, settings, registry_key ) );
-		lua_pushinteger( L, device_threads.size()-1 );
+		id = start_device<macrodevice::device_serial>( L, settings, callback_ref, hooks );
 		#else
 		std::cerr << "Error: Backend " << backend << " is not enabled\n";
 		#endif
@@ -373,8 +1443,31 @@ int lua_open_device( lua_State *L )
 	else if( backend == "xindicator" )
 	{
 		#ifdef USE_BACKEND_XINDICATOR
-		device_threads.push_back( std::jthread( run_macros<macrodevice::device_xindicator>, macrodevice::device_xindicator(), L, settings, registry_key ) );
-		lua_pushinteger( L, device_threads.size()-1 );
+		id = start_device<macrodevice::device_xindicator>( L, settings, callback_ref, hooks );
+		#else
+		std::cerr << "Error: Backend " << backend << " is not enabled\n";
+		#endif
+	}
+	else if( backend == "synthetic" )
+	{
+		#ifdef USE_BACKEND_SYNTHETIC
+		id = start_device<macrodevice::device_synthetic>( L, settings, callback_ref, hooks );
+		#else
+		std::cerr << "Error: Backend " << backend << " is not enabled\n";
+		#endif
+	}
+	else if( backend == "replay" )
+	{
+		#ifdef USE_BACKEND_REPLAY
+		id = start_device<macrodevice::device_replay>( L, settings, callback_ref, hooks );
+		#else
+		std::cerr << "Error: Backend " << backend << " is not enabled\n";
+		#endif
+	}
+	else if( backend == "hidraw" )
+	{
+		#ifdef USE_BACKEND_HIDRAW
+		id = start_device<macrodevice::device_hidraw>( L, settings, callback_ref, hooks );
 		#else
 		std::cerr << "Error: Backend " << backend << " is not enabled\n";
 		#endif
@@ -382,31 +1475,46 @@ int lua_open_device( lua_State *L )
 	else
 	{
 		std::cerr << "Error: Invalid backend\n";
-		lua_pushnil( L );
 	}
 	
+	if( id == -1 )
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, callback_ref );
+		luaL_unref( L, LUA_REGISTRYINDEX, hooks.connect_ref );
+		luaL_unref( L, LUA_REGISTRYINDEX, hooks.disconnect_ref );
+	}
+	
+	// remember the id for the Lua states of isolated devices
+	open_calls.push_back( id );
+	
+	push_device_id( L, id );
 	return 1;
 }
 
 /// Lua function to request closing a single or all device(s)
 int lua_close_device( lua_State *L )
 {
+	// the main Lua state has already run the top level code
+	if( is_loading_device_lua_state( L ) )
+		return 0;
+	
 	// close a single device
 	if( lua_gettop( L ) == 1 ){
 
 		// get argument
-		size_t id = luaL_checkinteger( L, -1 );
+		device_state *state = find_device( luaL_checkinteger( L, -1 ) );
 		lua_remove( L, -1 );
 
-		if( id < device_threads.size() )
-			device_threads.at(id).request_stop();
+		if( state )
+			state->stop.request_stop();
 	}
 
 	// close all devices
 	else if( lua_gettop( L ) == 0 )
 	{
-		for( auto &t : device_threads )
-			t.request_stop();
+		const std::lock_guard<std::mutex> lock( mutex_open_device );
+		for( auto &d : devices )
+			d.stop.request_stop();
 	}
 
 	else
@@ -414,11 +1522,338 @@ int lua_close_device( lua_State *L )
 		std::cerr << "Error: Invalid number of arguments to macrodevice.close()\n";
 	}
 
+	// devices handled by the reactor are closed by the reactor thread
+	reactor.wake();
+
+	return 0;
+}
+
+/// Lua function to get the event queue counters of a single device or of all devices
+int lua_queue_stats( lua_State *L )
+{
+	uint64_t queued = 0, dropped = 0, coalesced = 0, truncated = 0;
+	bool all_devices = lua_gettop( L ) == 0;
+	
+	if( !all_devices ) // a single device
+	{
+		device_state *state = find_device( luaL_checkinteger( L, 1 ) );
+		if( !state )
+		{
+			lua_pushnil( L );
+			return 1;
+		}
+		
+		queued = state->events_queued;
+		dropped = state->events_dropped;
+		coalesced = state->events_coalesced;
+		truncated = state->events_truncated;
+	}
+	else // all devices
+	{
+		const std::lock_guard<std::mutex> lock( mutex_open_device );
+		for( auto &d : devices )
+		{
+			queued += d.events_queued;
+			dropped += d.events_dropped;
+			coalesced += d.events_coalesced;
+			truncated += d.events_truncated;
+		}
+	}
+	
+	lua_newtable( L );
+	
+	lua_pushinteger( L, queued );
+	lua_setfield( L, -2, "queued" );
+	lua_pushinteger( L, dropped );
+	lua_setfield( L, -2, "dropped" );
+	lua_pushinteger( L, coalesced );
+	lua_setfield( L, -2, "coalesced" );
+	lua_pushinteger( L, truncated );
+	lua_setfield( L, -2, "truncated" );
+	
+	if( all_devices )
+	{
+		lua_pushinteger( L, queue.size() );
+		lua_setfield( L, -2, "size" );
+		lua_pushinteger( L, queue.capacity() );
+		lua_setfield( L, -2, "capacity" );
+	}
+	
+	return 1;
+}
+
+/// Pushes a table with the percentiles of a histogram in µs onto the Lua stack
+void push_histogram( lua_State *L, const macrodevice::histogram &h )
+{
+	lua_createtable( L, 0, 4 );
+	
+	lua_pushinteger( L, h.count() );
+	lua_setfield( L, -2, "count" );
+	lua_pushnumber( L, h.percentile( 0.5 ) / 1000.0 );
+	lua_setfield( L, -2, "p50" );
+	lua_pushnumber( L, h.percentile( 0.99 ) / 1000.0 );
+	lua_setfield( L, -2, "p99" );
+	lua_pushnumber( L, h.max() / 1000.0 );
+	lua_setfield( L, -2, "max" );
+}
+
+/// Lua function to get the latency statistics of a device
+int lua_stats( lua_State *L )
+{
+	device_state *device = find_device( luaL_checkinteger( L, 1 ) );
+	if( !device )
+	{
+		lua_pushnil( L );
+		return 1;
+	}
+	device_state &state = *device;
+	
+	lua_createtable( L, 0, 5 );
+	
+	lua_pushinteger( L, state.events_received );
+	lua_setfield( L, -2, "events" );
+	lua_pushinteger( L, state.errors );
+	lua_setfield( L, -2, "errors" );
+	
+	push_histogram( L, state.read_latency );
+	lua_setfield( L, -2, "read" );
+	push_histogram( L, state.lock_wait );
+	lua_setfield( L, -2, "lock_wait" );
+	push_histogram( L, state.callback_duration );
+	lua_setfield( L, -2, "callback" );
+	
+	return 1;
+}
+
+/// Lua function to send a message to a channel
+int lua_send( lua_State *L )
+{
+	size_t size;
+	std::string channel = luaL_checkstring( L, 1 );
+	const char *message = luaL_checklstring( L, 2, &size );
+	
+	// the main Lua state has already sent the messages of the top level code
+	if( is_loading_device_lua_state( L ) )
+		return 0;
+	
+	channels.send( channel, std::string( message, size ) );
+	
 	return 0;
 }
 
-/// Makes the macrodevice table available to the Lua state
-inline void lua_register_macrodevice( lua_State *L, std::vector< std::string > &arg )
+/// Lua function to add a binding to a device: macrodevice.bind( id, pattern, action ), returns true or nil in case of failure
+/// The pattern is a table of fields (numbers, numeric strings or names), or a string for backends with payload events
+/// (serial devices with unpack set have fields instead of payloads, so they take tables as well)
+/// The action is a function, or a string that gets run as a shell command
+int lua_bind( lua_State *L )
+{
+	int id = luaL_checkinteger( L, 1 );
+	
+	device_state *device = find_device( id );
+	if( !device )
+	{
+		std::cerr << "Error: Invalid device id passed to macrodevice.bind()\n";
+		lua_pushnil( L );
+		return 1;
+	}
+	device_state &state = *device;
+	
+	// the bindings of an isolated device belong to its own Lua state, other Lua states ignore them
+	bool own_state = true;
+	if( is_device_lua_state( L ) )
+	{
+		lua_getfield( L, LUA_REGISTRYINDEX, "macrodevice_open_call" );
+		int open_call = lua_tointeger( L, -1 );
+		lua_pop( L, 1 );
+		
+		own_state = open_call_id( L, open_call ) == id;
+	}
+	if( own_state != state.isolated )
+	{
+		lua_pushboolean( L, 1 );
+		return 1;
+	}
+	
+	// parse the pattern
+	//******************************************************************
+	macrodevice::event pattern;
+	std::string payload;
+	
+	if( state.payload_events && lua_type( L, 2 ) != LUA_TTABLE )
+	{
+		size_t size;
+		const char *p = luaL_checklstring( L, 2, &size );
+		payload.assign( p, size );
+		pattern.payload = payload.data();
+		pattern.payload_size = payload.size();
+	}
+	else
+	{
+		luaL_checktype( L, 2, LUA_TTABLE );
+		
+		size_t size = lua_rawlen( L, 2 );
+		if( size < 1 || size > MACRODEVICE_EVENT_SIZE )
+		{
+			std::cerr << "Error: Invalid pattern passed to macrodevice.bind()\n";
+			lua_pushnil( L );
+			return 1;
+		}
+		
+		for( size_t i = 0; i < size; i++ )
+		{
+			lua_rawgeti( L, 2, i+1 );
+			
+			long long value;
+			bool valid = false;
+			if( lua_type( L, -1 ) == LUA_TNUMBER )
+			{
+				value = lua_tointeger( L, -1 );
+				valid = true;
+			}
+			else if( lua_type( L, -1 ) == LUA_TSTRING )
+			{
+				// a number or a name
+				const char *field = lua_tostring( L, -1 );
+				char *end;
+				value = strtoll( field, &end, 10 );
+				valid = ( *field != '\0' && *end == '\0' ) ||
+					( state.field_from_name && state.field_from_name( i, field, pattern, value ) == MACRODEVICE_SUCCESS );
+			}
+			lua_pop( L, 1 );
+			
+			if( !valid )
+			{
+				std::cerr << "Error: Invalid field " << i+1 << " in the pattern passed to macrodevice.bind()\n";
+				lua_pushnil( L );
+				return 1;
+			}
+			
+			pattern.push( value );
+		}
+	}
+	
+	// store the action
+	//******************************************************************
+	macrodevice::binding binding;
+	binding.function = LUA_NOREF;
+	
+	if( lua_type( L, 3 ) == LUA_TSTRING )
+	{
+		binding.command = lua_tostring( L, 3 );
+	}
+	else if( !lua_isnoneornil( L, 3 ) ) // a function or a callable table
+	{
+		lua_pushvalue( L, 3 );
+		binding.function = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+	
+	if( binding.command.empty() && binding.function == LUA_NOREF )
+	{
+		std::cerr << "Error: Invalid action passed to macrodevice.bind()\n";
+		lua_pushnil( L );
+		return 1;
+	}
+	
+	// release the function of a replaced binding, events that already matched it look the binding up again, see BINDING_HANDLER
+	macrodevice::binding replaced;
+	if( state.bindings.add( pattern, binding, replaced ) && replaced.function != LUA_NOREF )
+		luaL_unref( L, LUA_REGISTRYINDEX, replaced.function );
+	
+	lua_pushboolean( L, 1 );
+	return 1;
+}
+
+/// Lua function to start a process without waiting for it: macrodevice.spawn( argv_or_command, options )
+/// argv_or_command is a table with the program and its arguments, or a string that gets run by /bin/sh
+/// options.on_exit gets called with the exit code, only in the main Lua state
+int lua_spawn( lua_State *L )
+{
+	std::vector< std::string > argv;
+	
+	if( lua_type( L, 1 ) == LUA_TSTRING )
+	{
+		argv = { "/bin/sh", "-c", lua_tostring( L, 1 ) };
+	}
+	else
+	{
+		luaL_checktype( L, 1, LUA_TTABLE );
+		
+		size_t size = lua_rawlen( L, 1 );
+		for( size_t i = 1; i <= size; i++ )
+		{
+			lua_rawgeti( L, 1, i );
+			if( lua_isstring( L, -1 ) )
+				argv.push_back( lua_tostring( L, -1 ) );
+			lua_pop( L, 1 );
+		}
+		
+		if( argv.size() != size || argv.empty() )
+		{
+			std::cerr << "Error: Invalid arguments passed to macrodevice.spawn()\n";
+			lua_pushnil( L );
+			return 1;
+		}
+	}
+	
+	// the exit callback
+	std::function< void( int ) > on_exit;
+	if( lua_type( L, 2 ) == LUA_TTABLE )
+	{
+		lua_getfield( L, 2, "on_exit" );
+		if( lua_isnil( L, -1 ) )
+		{
+			lua_pop( L, 1 );
+		}
+		else if( is_device_lua_state( L ) )
+		{
+			std::cerr << "Warning: on_exit is only supported in the main Lua state\n";
+			lua_pop( L, 1 );
+		}
+		else
+		{
+			int ref = luaL_ref( L, LUA_REGISTRYINDEX );
+			
+			on_exit = [L, ref]( int code )
+			{
+				const std::lock_guard<std::mutex> lock( mutex_lua );
+				
+				lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+				luaL_unref( L, LUA_REGISTRYINDEX, ref );
+				lua_pushinteger( L, code );
+				
+				if( lua_pcall( L, 1, 0, 0 ) != 0 ){
+					std::cerr << "An error occured: " << lua_tostring( L, -1 ) << "\n";
+					lua_remove( L, -1 );  // remove top value from stack
+				}
+			};
+		}
+	}
+	
+	// the main Lua state has already started the processes of the top level code
+	if( !is_loading_device_lua_state( L ) )
+		spawner.spawn( std::move( argv ), std::move( on_exit ) );
+	
+	lua_pushboolean( L, 1 );
+	return 1;
+}
+
+/// Lua function to receive a message from a channel, returns nil if no message has been received
+int lua_receive( lua_State *L )
+{
+	std::string channel = luaL_checkstring( L, 1 );
+	int timeout = luaL_optinteger( L, 2, 0 );
+	
+	std::string message;
+	if( channels.receive( channel, message, timeout ) == MACRODEVICE_SUCCESS )
+		lua_pushlstring( L, message.data(), message.size() );
+	else
+		lua_pushnil( L );
+	
+	return 1;
+}
+
+/// Makes the macrodevice table available to the Lua state, main is false for the Lua states of isolated devices
+inline void lua_register_macrodevice( lua_State *L, std::vector< std::string > &arg, bool main )
 {
     lua_newtable( L ); // create new table
 
@@ -432,12 +1867,40 @@ inline void lua_register_macrodevice( lua_State *L, std::vector< std::string > &
 
     lua_pushstring( L, "drop_root" ); // index
     lua_pushcfunction( L, lua_drop_root ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "queue_stats" ); // index
+    lua_pushcfunction( L, lua_queue_stats ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "send" ); // index
+    lua_pushcfunction( L, lua_send ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "receive" ); // index
+    lua_pushcfunction( L, lua_receive ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "bind" ); // index
+    lua_pushcfunction( L, lua_bind ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "spawn" ); // index
+    lua_pushcfunction( L, lua_spawn ); // value
+    lua_settable( L, -3 ); // table[index] = value, pops index and value
+
+	lua_pushstring( L, "stats" ); // index
+    lua_pushcfunction( L, lua_stats ); // value
     lua_settable( L, -3 ); // table[index] = value, pops index and value
 
     lua_pushstring( L, "version" ); // index
     lua_pushstring( L, VERSION_STRING ); // value
     lua_settable( L, -3 ); // table[index] = value, pops index and value
 
+	lua_pushstring( L, "main" ); // index
+	lua_pushboolean( L, main ); // value
+	lua_settable( L, -3 ); // table[index] = value, pops index and value
+
 	lua_pushstring( L, "arg" ); // index
 	lua_newtable( L ); // create new table
 	for( size_t i = 0; i < arg.size(); i++ )
@@ -452,6 +1915,94 @@ inline void lua_register_macrodevice( lua_State *L, std::vector< std::string > &
     lua_setglobal( L, "macrodevice" ); // name table, pops table from stack
 }
 
+/// Loads and runs the config file, returns 0 if successful
+int run_config( lua_State *L )
+{
+	if( config_language == "lua" ){
+		if( luaL_loadfile( L, config_path.c_str() ) || lua_pcall( L, 0, 0, 0 ) )
+		{
+			std::cerr << "Error in Lua: " << lua_tostring( L, -1 ) << "\n";
+			lua_remove( L, -1 ); // remove top value from stack
+			return 1;
+		}
+	}
+	else if( config_language == "fennel" )
+	{
+		if( luaL_dostring( L, std::string(
+			"package.path = \"" FENNEL_PATH "\"..package.path\n"
+			"local fennel = require(\"fennel\")\n"
+			"fennel.dofile(\"" +  config_path + "\")\n"
+		).c_str()) )
+		{
+			std::cerr << "Error in Lua: " << lua_tostring( L, -1 ) << "\n";
+			lua_remove( L, -1 ); // remove top value from stack
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+/// Creates the Lua state of an isolated device by loading the config file again
+/// open_call is the number of the macrodevice.open() call in the main Lua state that opened the device
+/// The registry reference of the callback of the device is stored in callback_ref
+/// Returns NULL in case of failure
+lua_State *new_device_lua_state( int open_call, int &callback_ref )
+{
+	// wait until the main Lua state has loaded the config, so that the ids of all devices are known
+	// open_calls grows when the main Lua state opens devices from an event handler, so it is copied while mutex_lua is locked
+	std::vector< int > ids;
+	{
+		const std::lock_guard<std::mutex> lock( mutex_lua );
+		ids = open_calls;
+	}
+	
+	lua_State *L = luaL_newstate(); // open lua
+	luaL_openlibs( L ); // open lua libraries
+	lua_register_macrodevice( L, lua_args, false );
+	
+	// macrodevice.open() uses this to find the callback of the device
+	lua_pushinteger( L, open_call );
+	lua_setfield( L, LUA_REGISTRYINDEX, "macrodevice_open_call" );
+	
+	// the ids returned by the calls of macrodevice.open() in the main Lua state, see open_call_id()
+	lua_createtable( L, ids.size(), 0 );
+	for( size_t i = 0; i < ids.size(); i++ )
+	{
+		lua_pushinteger( L, ids[i] );
+		lua_rawseti( L, -2, i+1 );
+	}
+	lua_setfield( L, LUA_REGISTRYINDEX, "macrodevice_open_ids" );
+	
+	// spawn, close and send do nothing while the top level code runs again
+	lua_pushboolean( L, 1 );
+	lua_setfield( L, LUA_REGISTRYINDEX, "macrodevice_loading" );
+	
+	if( run_config( L ) != 0 )
+	{
+		lua_close( L );
+		return NULL;
+	}
+	
+	lua_pushnil( L );
+	lua_setfield( L, LUA_REGISTRYINDEX, "macrodevice_loading" );
+	
+	// check if the callback has been stored
+	lua_getfield( L, LUA_REGISTRYINDEX, DEVICE_CALLBACK_KEY );
+	bool found = !lua_isnil( L, -1 );
+	callback_ref = lua_tointeger( L, -1 );
+	lua_pop( L, 1 );
+	
+	if( !found )
+	{
+		std::cerr << "Error: Isolated devices need to be opened while the config is loaded\n";
+		lua_close( L );
+		return NULL;
+	}
+	
+	return L;
+}
+
 // main function
 //**********************************************************************
 int main( int argc, char *argv[] )
@@ -475,7 +2026,6 @@ int main( int argc, char *argv[] )
 		int c, option_index = 0;
 		bool flag_fork = false, flag_config = false;
 		std::string string_config, string_language = "lua";
-		std::vector< std::string > lua_args;
 			
 		while( (c = getopt_long( argc, argv, "hc:fa:l:", long_options, &option_index ) ) != -1 )
 		{
@@ -536,6 +2086,9 @@ int main( int argc, char *argv[] )
 			return 1;
 		}
 		
+		config_path = string_config;
+		config_language = string_language;
+		
 		// fork ?
 		//**************************************************************
 		if( flag_fork )
@@ -560,35 +2113,24 @@ int main( int argc, char *argv[] )
 		
 		
 		// make macrodevice functions available to Lua
-		lua_register_macrodevice( L, lua_args );
+		lua_register_macrodevice( L, lua_args, true );
 		
+		bool config_failed = false;
 		{
 			// lock lua mutex
 			const std::lock_guard<std::mutex> lock( mutex_lua );
 			
 			// load and run the config file
-			if( string_language == "lua" ){
-				if( luaL_loadfile( L, string_config.c_str() ) || lua_pcall( L, 0, 0, 0 ) )
-				{
-					std::cerr << "Error in Lua: " << lua_tostring( L, -1 ) << "\n";
-					lua_remove( L, -1 ); // remove top value from stack
-					lua_close( L );
-					return 1;
-				}
-			}
-			else if( string_language == "fennel" )
+			if( run_config( L ) != 0 )
 			{
-				if( luaL_dostring( L, std::string(
-					"package.path = \"" FENNEL_PATH "\"..package.path\n"
-					"local fennel = require(\"fennel\")\n"
-					"fennel.dofile(\"" +  string_config + "\")\n"
-				).c_str()) )
-				{
-					std::cerr << "Error in Lua: " << lua_tostring( L, -1 ) << "\n";
-					lua_remove( L, -1 ); // remove top value from stack
-					lua_close( L );
-					return 1;
-				}
+				// close the devices opened before the error, the shutdown below waits for them
+				// the device threads don't use the stop token of their jthread, they are stopped through their device
+				config_failed = true;
+				
+				const std::lock_guard<std::mutex> lock_devices( mutex_open_device );
+				for( auto &d : devices )
+					d.stop.request_stop();
+				reactor.wake();
 			}
 		}
 
@@ -597,10 +2139,29 @@ int main( int argc, char *argv[] )
 		for( auto &t : device_threads )
 			t.join();
 		
+		// lost devices of the reactor get added to it again once they have been reopened
+		do
+			reactor.join();
+		while( hotplug.join() );
+		
+		// handle the remaining queued events
+		if( dispatcher_thread.joinable() )
+		{
+			dispatcher_thread.request_stop();
+			queue.wake();
+			dispatcher_thread.join();
+		}
+		
+		// stop calling on_exit callbacks of running processes
+		spawner.stop();
+		
 		// cleanup
 		//**************************************************************
 		lua_close( L );
 		
+		if( config_failed )
+			return 1;
+		
 	}
 	catch( std::exception &e ) // excepetion handler
 	{
@@ -0,0 +1,245 @@
+/*
+ * reactor.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "reactor.h"
+
+macrodevice::reactor::~reactor()
+{
+	if( m_thread.joinable() )
+	{
+		m_thread.request_stop();
+		wake();
+		m_thread.join();
+	}
+	
+	if( m_wakefd >= 0 )
+		close( m_wakefd );
+	if( m_epollfd >= 0 )
+		close( m_epollfd );
+}
+
+/**
+ * @copydoc macrodevice::reactor::add_source
+ */
+int macrodevice::reactor::add_source( const std::vector< struct pollfd > &fds, std::function< bool() > service, std::function< void() > close, std::stop_token stop )
+{
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	// create the epoll instance and the wakeup eventfd on first use
+	if( m_epollfd < 0 )
+	{
+		m_epollfd = epoll_create1( EPOLL_CLOEXEC );
+		m_wakefd = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC );
+		if( m_epollfd < 0 || m_wakefd < 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+		
+		// user data 0 is reserved for the eventfd
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		if( epoll_ctl( m_epollfd, EPOLL_CTL_ADD, m_wakefd, &ev ) != 0 )
+		{
+			return MACRODEVICE_FAILURE;
+		}
+	}
+	
+	// watch all file descriptors of the source
+	uint64_t id = m_next_id++;
+	std::vector< int > added;
+	for( size_t i = 0; i < fds.size(); i++ )
+	{
+		struct epoll_event ev = {};
+		if( fds.at(i).events & POLLIN )
+			ev.events |= EPOLLIN;
+		if( fds.at(i).events & POLLOUT )
+			ev.events |= EPOLLOUT;
+		ev.data.u64 = id;
+		if( epoll_ctl( m_epollfd, EPOLL_CTL_ADD, fds.at(i).fd, &ev ) != 0 )
+		{
+			// undo partially added source
+			for( int fd : added )
+				epoll_ctl( m_epollfd, EPOLL_CTL_DEL, fd, NULL );
+			
+			return MACRODEVICE_FAILURE;
+		}
+		added.push_back( fds.at(i).fd );
+	}
+	
+	m_sources.emplace( id, source{ added, std::move( service ), std::move( close ), stop } );
+	
+	// (re)start the event loop
+	if( !m_running )
+	{
+		if( m_thread.joinable() )
+			m_thread.join();
+		
+		m_running = true;
+		m_thread = std::jthread( [this]( std::stop_token st ){ run( st ); } );
+	}
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::reactor::wake
+ */
+void macrodevice::reactor::wake()
+{
+	if( m_wakefd >= 0 )
+	{
+		uint64_t one = 1;
+		if( write( m_wakefd, &one, sizeof( one ) ) < 0 )
+		{
+			// the counter can't overflow in practice, the loop is awake anyway
+		}
+	}
+}
+
+/**
+ * @copydoc macrodevice::reactor::join
+ */
+void macrodevice::reactor::join()
+{
+	std::jthread thread;
+	
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		thread = std::move( m_thread );
+	}
+	
+	if( thread.joinable() )
+		thread.join();
+}
+
+/**
+ * @copydoc macrodevice::reactor::remove_source
+ */
+void macrodevice::reactor::remove_source( uint64_t id )
+{
+	std::function< void() > close;
+	
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		
+		auto s = m_sources.find( id );
+		if( s == m_sources.end() )
+			return;
+		
+		for( auto fd : s->second.fds )
+			epoll_ctl( m_epollfd, EPOLL_CTL_DEL, fd, NULL );
+		
+		close = std::move( s->second.close );
+		m_sources.erase( s );
+	}
+	
+	// the close function is called without holding the mutex, as it may call back into the reactor
+	if( close )
+		close();
+}
+
+/**
+ * @copydoc macrodevice::reactor::run
+ */
+void macrodevice::reactor::run( std::stop_token st )
+{
+	struct epoll_event ready[64];
+	std::vector< uint64_t > finished;
+	
+	while( true )
+	{
+		// remove all sources with a requested stop, or all sources if the reactor is stopped
+		{
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			
+			for( auto &s : m_sources )
+			{
+				if( s.second.stop.stop_requested() || st.stop_requested() )
+					finished.push_back( s.first );
+			}
+		}
+		
+		for( auto id : finished )
+			remove_source( id );
+		finished.clear();
+		
+		// quit if there is nothing left to do
+		{
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			
+			if( m_sources.empty() || st.stop_requested() )
+			{
+				m_running = false;
+				return;
+			}
+		}
+		
+		// wait for input
+		int n = epoll_wait( m_epollfd, ready, 64, -1 );
+		if( n < 0 )
+		{
+			// interrupted by a signal, or a fatal error
+			if( errno == EINTR )
+				continue;
+			
+			const std::lock_guard<std::mutex> lock( m_mutex );
+			m_running = false;
+			return;
+		}
+		
+		for( int i = 0; i < n; i++ )
+		{
+			uint64_t id = ready[i].data.u64;
+			
+			// wakeup request, reset the eventfd
+			if( id == 0 )
+			{
+				uint64_t value;
+				if( read( m_wakefd, &value, sizeof( value ) ) < 0 )
+				{
+					// already reset
+				}
+				continue;
+			}
+			
+			// get the source, the pointer stays valid as sources are only erased by this thread
+			source *s = NULL;
+			{
+				const std::lock_guard<std::mutex> lock( m_mutex );
+				
+				auto it = m_sources.find( id );
+				if( it != m_sources.end() )
+					s = &it->second;
+			}
+			
+			// the source has already been removed, because multiple file descriptors were ready
+			if( s == NULL )
+				continue;
+			
+			// handle input, the mutex is not held as service may add new sources
+			bool keep = s->service();
+			
+			// remove the source if requested or if the device has been disconnected
+			if( !keep || ( ready[i].events & ( EPOLLERR|EPOLLHUP ) ) )
+				remove_source( id );
+		}
+	}
+}
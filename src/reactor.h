@@ -0,0 +1,127 @@
+/*
+ * reactor.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_REACTOR
+#define MACRODEVICE_REACTOR
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <stop_token>
+#include <thread>
+#include <cstdint>
+#include <cerrno>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h> // for close()
+
+#include "backends/helpers.h"
+
+namespace macrodevice
+{
+	class reactor;
+}
+
+/**
+ * A single epoll loop that handles the events of multiple devices.
+ * Each device is added as a source, consisting of the file descriptors
+ * to watch and a function that gets called when one of them is ready.
+ */
+class macrodevice::reactor
+{
+	
+	private:
+		
+		/// A device handled by the reactor
+		struct source
+		{
+			/// file descriptors watched for this source
+			std::vector< int > fds;
+			
+			/// called when a file descriptor is ready, returns false if the source should be removed
+			std::function< bool() > service;
+			
+			/// called once after the source has been removed
+			std::function< void() > close;
+			
+			/// the source gets removed when a stop is requested
+			std::stop_token stop;
+		};
+		
+		/// epoll file descriptor
+		int m_epollfd = -1;
+		
+		/// eventfd used to wake up the loop, e.g. when closing a device
+		int m_wakefd = -1;
+		
+		/// id of the next source, used as epoll user data
+		uint64_t m_next_id = 1;
+		
+		/// all sources, guarded by m_mutex
+		std::map< uint64_t, source > m_sources;
+		
+		/// is run() currently executing? guarded by m_mutex
+		bool m_running = false;
+		
+		std::mutex m_mutex;
+		
+		/// the thread executing run()
+		std::jthread m_thread;
+		
+		/// Removes a source and calls its close function, m_mutex must not be locked
+		void remove_source( uint64_t id );
+		
+		/**
+		 * The event loop, returns when all sources have been removed or a stop is requested
+		 * @param st Stop token
+		 */
+		void run( std::stop_token st );
+		
+	public:
+		
+		~reactor();
+		
+		/**
+		 * Adds a new source to the reactor, starts the event loop thread if it isn't running
+		 * @param fds The file descriptors to watch, with their events (POLLIN, POLLOUT)
+		 * @param service Called when input is available, should handle all pending input and return false to remove the source
+		 * @param close Called after the source has been removed
+		 * @param stop The source gets removed when a stop is requested, call wake() after requesting a stop
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int add_source( const std::vector< struct pollfd > &fds, std::function< bool() > service, std::function< void() > close, std::stop_token stop );
+		
+		/**
+		 * Wakes up the event loop, so that stop requests are noticed
+		 */
+		void wake();
+		
+		/**
+		 * Waits until all sources have been removed
+		 */
+		void join();
+		
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * recorder.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "recorder.h"
+
+macrodevice::recorder::~recorder()
+{
+	close();
+}
+
+/**
+ * @copydoc macrodevice::recorder::open
+ */
+int macrodevice::recorder::open( const std::string &path )
+{
+	m_filedesc = ::open( path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644 );
+	if( m_filedesc < 0 )
+	{
+		return MACRODEVICE_FAILURE;
+	}
+	
+	// start a new session, the name indices start again at 0
+	m_buffer.insert( m_buffer.end(), MACRODEVICE_LOG_MAGIC, MACRODEVICE_LOG_MAGIC + MACRODEVICE_LOG_MAGIC_SIZE );
+	
+	m_writer = std::jthread( [this]( std::stop_token st ){ write_buffer( st ); } );
+	
+	return MACRODEVICE_SUCCESS;
+}
+
+/**
+ * @copydoc macrodevice::recorder::record
+ */
+void macrodevice::recorder::record( const macrodevice::event &event )
+{
+	m_record.clear();
+	
+	// name records for new names
+	for( unsigned int i = 0; i < event.size; i++ )
+	{
+		if( !event.name[i] || m_names.contains( event.name[i] ) || m_names.size() >= MACRODEVICE_LOG_NO_NAME )
+			continue;
+		
+		macrodevice::log_name name;
+		name.kind = MACRODEVICE_LOG_NAME;
+		name.reserved = 0;
+		name.index = m_names.size();
+		name.length = strlen( event.name[i] ) + 1;
+		
+		append( &name, sizeof( name ) );
+		append( event.name[i], name.length );
+		
+		m_names.emplace( event.name[i], (uint16_t)name.index );
+	}
+	
+	// the event record
+	macrodevice::log_event header;
+	header.kind = MACRODEVICE_LOG_EVENT;
+	header.size = event.size;
+	header.has_payload = event.payload ? 1 : 0;
+	header.reserved = 0;
+	header.payload_size = event.payload ? event.payload_size : 0;
+	header.timestamp = event.timestamp;
+	append( &header, sizeof( header ) );
+	
+	for( unsigned int i = 0; i < header.size; i++ )
+	{
+		macrodevice::log_field field;
+		field.value = event.value[i];
+		field.name = MACRODEVICE_LOG_NO_NAME;
+		if( event.name[i] && m_names.contains( event.name[i] ) )
+			field.name = m_names.at( event.name[i] );
+		
+		append( &field, sizeof( field ) );
+	}
+	
+	if( event.payload )
+		append( event.payload, event.payload_size );
+	
+	// pass the records to the writer
+	bool full;
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		m_buffer.insert( m_buffer.end(), m_record.begin(), m_record.end() );
+		full = m_buffer.size() >= MACRODEVICE_RECORDER_FLUSH_SIZE;
+	}
+	
+	if( full )
+		m_filled.notify_one();
+}
+
+/**
+ * @copydoc macrodevice::recorder::close
+ */
+void macrodevice::recorder::close()
+{
+	if( m_writer.joinable() )
+	{
+		m_writer.request_stop();
+		m_writer.join();
+	}
+	
+	if( m_filedesc >= 0 )
+	{
+		::close( m_filedesc );
+		m_filedesc = -1;
+	}
+}
+
+/**
+ * @copydoc macrodevice::recorder::write_buffer
+ */
+void macrodevice::recorder::write_buffer( std::stop_token st )
+{
+	std::vector< char > buffer;
+	
+	while( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			m_filled.wait_for( lock, st, std::chrono::milliseconds( MACRODEVICE_RECORDER_FLUSH_INTERVAL ),
+				[this](){ return m_buffer.size() >= MACRODEVICE_RECORDER_FLUSH_SIZE; } );
+			
+			// take the buffer, the recording thread continues with the empty buffer
+			buffer.swap( m_buffer );
+		}
+		
+		size_t written = 0;
+		while( written < buffer.size() )
+		{
+			ssize_t result = write( m_filedesc, buffer.data() + written, buffer.size() - written );
+			if( result < 0 )
+			{
+				if( errno == EINTR )
+					continue;
+				break;
+			}
+			written += result;
+		}
+		buffer.clear();
+		
+		// the remaining records have been written
+		if( st.stop_requested() )
+			return;
+	}
+}
+
+/**
+ * @copydoc macrodevice::recorder::append
+ */
+void macrodevice::recorder::append( const void *data, size_t size )
+{
+	const char *bytes = static_cast< const char* >( data );
+	m_record.insert( m_record.end(), bytes, bytes + size );
+}
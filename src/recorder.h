@@ -0,0 +1,111 @@
+/*
+ * recorder.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_RECORDER
+#define MACRODEVICE_RECORDER
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stop_token>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h> // for open()
+#include <unistd.h> // for write()
+
+#include "backends/helpers.h"
+#include "backends/event-log.h"
+
+/// Size of the buffer in bytes at which the writer thread gets woken up
+#define MACRODEVICE_RECORDER_FLUSH_SIZE 65536
+
+/// Maximum time in ms between writes
+#define MACRODEVICE_RECORDER_FLUSH_INTERVAL 100
+
+namespace macrodevice
+{
+	class recorder;
+}
+
+/**
+ * Appends the events of a device to an event log (see event-log.h).
+ * record() only encodes the event into a buffer, a separate thread writes the buffer to the file.
+ * record() must always be called from the same thread.
+ */
+class macrodevice::recorder
+{
+	
+	private:
+		
+		int m_filedesc = -1;
+		
+		/// encoded records not written yet, guarded by m_mutex
+		std::vector< char > m_buffer;
+		
+		std::mutex m_mutex;
+		
+		/// notified when the buffer is large enough to be written
+		std::condition_variable_any m_filled;
+		
+		/// indices of the names that have been written, only used by record()
+		std::unordered_map< const char*, uint16_t > m_names;
+		
+		/// the records of the current event, before they get appended to m_buffer
+		std::vector< char > m_record;
+		
+		std::jthread m_writer;
+		
+		/// Thread function of the writer
+		void write_buffer( std::stop_token st );
+		
+		/// Appends bytes to m_record
+		void append( const void *data, size_t size );
+		
+	public:
+		
+		~recorder();
+		
+		/**
+		 * Opens the log file for appending and starts the writer thread
+		 * @param path The path of the log file, gets created if it doesn't exist
+		 * @return MACRODEVICE_SUCCESS or MACRODEVICE_FAILURE
+		 */
+		int open( const std::string &path );
+		
+		/**
+		 * Adds an event to the log
+		 * @param event The event
+		 */
+		void record( const macrodevice::event &event );
+		
+		/**
+		 * Writes the remaining records and closes the log file
+		 */
+		void close();
+		
+};
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * spawner.cpp
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+#include "spawner.h"
+
+extern char **environ;
+
+macrodevice::spawner::~spawner()
+{
+	stop();
+}
+
+/**
+ * @copydoc macrodevice::spawner::spawn
+ */
+void macrodevice::spawner::spawn( std::vector< std::string > argv, std::function< void( int ) > on_exit )
+{
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	// start the workers on first use
+	if( m_workers.empty() )
+	{
+		for( int i = 0; i < MACRODEVICE_SPAWN_WORKERS; i++ )
+			m_workers.emplace_back( [this]( std::stop_token st ){ work( st ); } );
+	}
+	
+	m_jobs.push_back( { std::move( argv ), std::move( on_exit ) } );
+	m_added.notify_one();
+}
+
+/**
+ * @copydoc macrodevice::spawner::stop
+ */
+void macrodevice::spawner::stop()
+{
+	std::vector< std::jthread > workers;
+	
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		workers.swap( m_workers );
+		m_jobs.clear();
+	}
+	
+	for( auto &w : workers )
+		w.request_stop();
+	for( auto &w : workers )
+		w.join();
+	
+	m_stop.request_stop();
+	m_reaper.wake();
+	m_reaper.join();
+	
+	std::jthread waiter;
+	{
+		const std::lock_guard<std::mutex> lock( m_mutex );
+		waiter.swap( m_waiter );
+		m_children.clear();
+	}
+	
+	if( waiter.joinable() )
+	{
+		waiter.request_stop();
+		waiter.join();
+	}
+}
+
+/**
+ * @copydoc macrodevice::spawner::work
+ */
+void macrodevice::spawner::work( std::stop_token st )
+{
+	while( true )
+	{
+		job j;
+		
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			if( !m_added.wait( lock, st, [this](){ return !m_jobs.empty(); } ) )
+				return;
+			
+			j = std::move( m_jobs.front() );
+			m_jobs.pop_front();
+		}
+		
+		start( j );
+	}
+}
+
+/**
+ * @copydoc macrodevice::spawner::start
+ */
+void macrodevice::spawner::start( job &j )
+{
+	if( j.argv.empty() )
+		return;
+	
+	std::vector< char* > argv;
+	for( auto &a : j.argv )
+		argv.push_back( a.data() );
+	argv.push_back( NULL );
+	
+	// the child shouldn't inherit the signal mask of this thread
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	sigemptyset( &mask );
+	posix_spawnattr_init( &attr );
+	posix_spawnattr_setsigmask( &attr, &mask );
+	posix_spawnattr_setflags( &attr, POSIX_SPAWN_SETSIGMASK );
+	
+	pid_t pid;
+	int result = posix_spawnp( &pid, argv[0], NULL, &attr, argv.data(), environ );
+	posix_spawnattr_destroy( &attr );
+	
+	if( result != 0 )
+	{
+		std::cerr << "Warning: Could not start " << j.argv[0] << "\n";
+		if( j.on_exit )
+			j.on_exit( 127 );
+		return;
+	}
+	
+	// reap the process when its pidfd becomes readable
+	#ifdef SYS_pidfd_open
+	int pidfd = syscall( SYS_pidfd_open, pid, 0 );
+	if( pidfd >= 0 )
+	{
+		auto on_exit = std::move( j.on_exit );
+		
+		auto service = [pid, on_exit]() -> bool
+		{
+			int status;
+			if( waitpid( pid, &status, WNOHANG ) == 0 )
+				return true;
+			
+			if( on_exit )
+				on_exit( exit_code( status ) );
+			return false;
+		};
+		
+		if( m_reaper.add_source( { { pidfd, POLLIN, 0 } }, service, [pidfd](){ close( pidfd ); }, m_stop.get_token() ) == MACRODEVICE_SUCCESS )
+			return;
+		
+		close( pidfd );
+		j.on_exit = std::move( on_exit );
+	}
+	#endif
+	
+	// no pidfd available, the process is reaped by the waiter thread, so the worker can start the next process
+	const std::lock_guard<std::mutex> lock( m_mutex );
+	
+	if( !m_waiter.joinable() )
+		m_waiter = std::jthread( [this]( std::stop_token st ){ reap( st ); } );
+	
+	m_children.insert_or_assign( pid, std::move( j.on_exit ) );
+	m_child_added.notify_one();
+}
+
+/**
+ * @copydoc macrodevice::spawner::reap
+ */
+void macrodevice::spawner::reap( std::stop_token st )
+{
+	std::vector< std::pair< std::function< void( int ) >, int > > exited;
+	std::unique_lock<std::mutex> lock( m_mutex );
+	
+	while( true )
+	{
+		// sleep while there are no processes
+		if( !m_child_added.wait( lock, st, [this](){ return !m_children.empty(); } ) )
+			return;
+		
+		for( auto it = m_children.begin(); it != m_children.end(); )
+		{
+			int status;
+			pid_t result = waitpid( it->first, &status, WNOHANG );
+			if( result == 0 )
+			{
+				it++;
+				continue;
+			}
+			
+			// the process has exited, or has already been reaped by someone else (result < 0)
+			if( result == it->first && it->second )
+				exited.push_back( { std::move( it->second ), exit_code( status ) } );
+			it = m_children.erase( it );
+		}
+		
+		// call on_exit without holding the mutex, it might spawn another process
+		if( !exited.empty() )
+		{
+			lock.unlock();
+			for( auto &e : exited )
+				e.first( e.second );
+			exited.clear();
+			lock.lock();
+		}
+		
+		// check again after the interval, or earlier if the spawner is stopped
+		m_child_added.wait_for( lock, st, std::chrono::milliseconds( MACRODEVICE_REAP_INTERVAL ), [](){ return false; } );
+		if( st.stop_requested() )
+			return;
+	}
+}
+
+/**
+ * @copydoc macrodevice::spawner::exit_code
+ */
+int macrodevice::spawner::exit_code( int status )
+{
+	if( WIFSIGNALED( status ) )
+		return 128 + WTERMSIG( status );
+	
+	return WEXITSTATUS( status );
+}
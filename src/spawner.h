@@ -0,0 +1,136 @@
+/*
+ * spawner.h
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+/// Header guard
+#ifndef MACRODEVICE_SPAWNER
+#define MACRODEVICE_SPAWNER
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stop_token>
+#include <thread>
+#include <iostream>
+
+#include <spawn.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "backends/helpers.h"
+
+/// Number of worker threads that start processes
+#define MACRODEVICE_SPAWN_WORKERS 2
+
+/// Interval in ms to check for exited processes if pidfd_open is not available
+#define MACRODEVICE_REAP_INTERVAL 20
+
+namespace macrodevice
+{
+	class spawner;
+}
+
+/**
+ * Starts processes with posix_spawn on a small pool of worker threads, without blocking the caller.
+ * Exited processes are reaped through a pidfd, watched by a separate reactor.
+ * Without pidfds (Linux < 5.3), a single thread checks the running processes until they have exited.
+ * All member functions are thread safe.
+ */
+class macrodevice::spawner
+{
+	
+	private:
+		
+		/// A process that should be started
+		struct job
+		{
+			std::vector< std::string > argv;
+			std::function< void( int ) > on_exit;
+		};
+		
+		/// jobs waiting for a worker, guarded by m_mutex
+		std::deque< job > m_jobs;
+		
+		std::mutex m_mutex;
+		
+		/// notified when a job is added
+		std::condition_variable_any m_added;
+		
+		std::vector< std::jthread > m_workers;
+		
+		/// watches the pidfds of the running processes
+		macrodevice::reactor m_reaper;
+		
+		/// used to stop watching the running processes
+		std::stop_source m_stop;
+		
+		/// processes without a pidfd and their on_exit functions, guarded by m_mutex
+		std::map< pid_t, std::function< void( int ) > > m_children;
+		
+		/// notified when a process is added to m_children
+		std::condition_variable_any m_child_added;
+		
+		/// reaps the processes in m_children, started on first use
+		std::jthread m_waiter;
+		
+		/// Thread function of the workers
+		void work( std::stop_token st );
+		
+		/// Thread function that reaps the processes in m_children, waitpid( -1 ) would also reap processes started by os.execute or io.popen
+		void reap( std::stop_token st );
+		
+		/**
+		 * Starts a process and passes it to the reaper
+		 * @param j The job
+		 */
+		void start( job &j );
+		
+		/**
+		 * Converts the status from waitpid to an exit code, 128 + the signal number if the process has been killed
+		 */
+		static int exit_code( int status );
+		
+	public:
+		
+		~spawner();
+		
+		/**
+		 * Starts a process without waiting for it, the program is searched in PATH
+		 * @param argv The program and its arguments
+		 * @param on_exit Called with the exit code after the process has exited (127 if it couldn't be started), can be empty
+		 */
+		void spawn( std::vector< std::string > argv, std::function< void( int ) > on_exit );
+		
+		/**
+		 * Stops the workers and stops watching the running processes, on_exit doesn't get called after this returns
+		 */
+		void stop();
+		
+};
+
+#endif